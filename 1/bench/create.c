@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../libcoro.h"
+
+/**
+ * Coroutine creation benchmark. Short-lived coroutines are created
+ * in batches, each is run once and deleted. Build it with the
+ * default backend and with -DCORO_USE_SIGJMP=1 (the signal based
+ * creation) to compare them:
+ *
+ * $> make bench
+ * $> ./bench_create; ./bench_create_sigjmp
+ */
+
+enum {
+	BATCH_SIZE = 100,
+	DEFAULT_CORO_COUNT = 200 * 1000,
+};
+
+static int
+noop_f(void *arg)
+{
+	(void)arg;
+	return 0;
+}
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+	long long count = DEFAULT_CORO_COUNT;
+	if (argc > 1)
+		count = atoll(argv[1]);
+	coro_sched_init();
+	/* Let the whole batch reuse the cached stacks. */
+	coro_sched_set_stack_cache_size(BATCH_SIZE);
+
+	long long start = now_ns();
+	long long created = 0;
+	while (created < count) {
+		for (int i = 0; i < BATCH_SIZE && created < count; ++i) {
+			coro_new(noop_f, NULL);
+			++created;
+		}
+		struct coro *c;
+		while ((c = coro_sched_wait()) != NULL)
+			coro_delete(c);
+	}
+	long long duration = now_ns() - start;
+	printf("backend: %s\n", CORO_USE_SIGJMP ? "sigjmp" : "asm");
+	printf("coroutines: %lld\n", created);
+	printf("total: %.3f ms\n", duration / 1000000.0);
+	printf("per coroutine: %.2f ns\n", (double)duration / created);
+	printf("per second: %.0f\n", created * 1000000000.0 / duration);
+	struct coro_stack_stat stat;
+	coro_sched_stack_stat(&stat);
+	printf("stack pool: hits %lld, misses %lld, peak resident %lld\n",
+	       stat.hits, stat.misses, stat.peak_resident);
+	coro_sched_destroy();
+	return 0;
+}
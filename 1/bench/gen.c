@@ -0,0 +1,231 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../int_write.h"
+
+/**
+ * Native test data generator - generator.py in C, much faster, and
+ * with skewed distributions. The numbers are formatted by int_writer
+ * straight into the file, so huge files take no memory.
+ *
+ *   random  - uniform in [0, max], like generator.py;
+ *   sorted  - not decreasing;
+ *   reverse - not increasing;
+ *   few     - uniform over -u distinct values;
+ *   zipf    - Zipfian over -u distinct values with exponent -z, the
+ *             most frequent value is rank 1.
+ *
+ * The count takes K, M and G suffixes.
+ *
+ * $> make bench
+ * $> ./bench_gen -f test1.txt -c 10M [-d zipf] [-m max] [-u unique]
+ *	[-z exponent] [-s seed]
+ */
+
+enum {
+	BATCH = 1024,
+	DEFAULT_UNIQUE = 16,
+	DEFAULT_ZIPF_UNIQUE = 1000 * 1000,
+};
+
+enum dist {
+	DIST_RANDOM,
+	DIST_SORTED,
+	DIST_REVERSE,
+	DIST_FEW,
+	DIST_ZIPF,
+};
+
+static const char *dist_names[] = {
+	"random", "sorted", "reverse", "few", "zipf",
+};
+
+/** splitmix64. */
+static uint64_t
+rand_next(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/** Uniform in [0, 1). */
+static double
+rand_double(uint64_t *state)
+{
+	return (rand_next(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/** Cumulative distribution of Zipf ranks 1..@a count. */
+static double *
+zipf_cdf_new(int count, double exponent)
+{
+	double *cdf = malloc(sizeof(cdf[0]) * count);
+	double sum = 0;
+	for (int i = 0; i < count; ++i) {
+		sum += 1 / pow(i + 1, exponent);
+		cdf[i] = sum;
+	}
+	for (int i = 0; i < count; ++i)
+		cdf[i] /= sum;
+	return cdf;
+}
+
+/** Zero based rank of a random sample, by a binary search. */
+static int
+zipf_rank(const double *cdf, int count, uint64_t *state)
+{
+	double u = rand_double(state);
+	int lo = 0;
+	int hi = count - 1;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/** Parse a count with an optional K, M or G suffix. */
+static long long
+parse_count(const char *str)
+{
+	char *end;
+	long long v = strtoll(str, &end, 10);
+	switch (*end) {
+	case 'K': case 'k':
+		return v * 1000;
+	case 'M': case 'm':
+		return v * 1000 * 1000;
+	case 'G': case 'g':
+		return v * 1000 * 1000 * 1000;
+	case 0:
+		return v;
+	default:
+		return -1;
+	}
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s -f file -c count [-d random|sorted|"
+		"reverse|few|zipf] [-m max] [-u unique] [-z exponent] "
+		"[-s seed]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *path = NULL;
+	long long count = -1;
+	enum dist dist = DIST_RANDOM;
+	long long max = (1LL << 31) - 1;
+	int unique = 0;
+	double exponent = 1;
+	uint64_t seed = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:c:d:m:u:z:s:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'c':
+			count = parse_count(optarg);
+			break;
+		case 'd':
+			dist = 0;
+			while (dist <= DIST_ZIPF &&
+			       strcmp(dist_names[dist], optarg) != 0)
+				++dist;
+			break;
+		case 'm':
+			max = atoll(optarg);
+			break;
+		case 'u':
+			unique = atoi(optarg);
+			break;
+		case 'z':
+			exponent = atof(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (path == NULL || count < 0 || dist > DIST_ZIPF || max < 0 ||
+	    max > (1LL << 31) - 1 || unique < 0 || exponent <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (unique == 0)
+		unique = dist == DIST_ZIPF ? DEFAULT_ZIPF_UNIQUE :
+			 DEFAULT_UNIQUE;
+	if (unique > max + 1)
+		unique = max + 1;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	double *cdf = dist == DIST_ZIPF ? zipf_cdf_new(unique, exponent) :
+		      NULL;
+	/* Distinct values spread over the range, for few and zipf. */
+	long long step = (max + 1) / unique;
+	struct int_writer w;
+	int_writer_create(&w, fd);
+	int batch[BATCH];
+	int rc = 0;
+	for (long long i = 0; i < count && rc == 0;) {
+		int size = count - i < BATCH ? count - i : BATCH;
+		for (int j = 0; j < size; ++j, ++i) {
+			long long v;
+			switch (dist) {
+			case DIST_RANDOM:
+				v = rand_next(&seed) % (max + 1);
+				break;
+			case DIST_SORTED:
+				v = (long double)i * max / count;
+				break;
+			case DIST_REVERSE:
+				v = max - (long long)((long double)i * max /
+						      count);
+				break;
+			case DIST_FEW:
+				v = rand_next(&seed) % unique * step;
+				break;
+			default:
+				/*
+				 * The ranks are scattered, so the frequent
+				 * values are not all small.
+				 */
+				v = (long long)zipf_rank(cdf, unique, &seed) *
+				    2654435761LL % unique * step;
+				break;
+			}
+			batch[j] = v;
+		}
+		rc = int_writer_put(&w, batch, size);
+	}
+	if (rc == 0)
+		rc = int_writer_flush(&w);
+	int_writer_destroy(&w);
+	free(cdf);
+	if (close(fd) != 0)
+		rc = -1;
+	if (rc != 0) {
+		perror(path);
+		return 1;
+	}
+	return 0;
+}
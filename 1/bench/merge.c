@@ -0,0 +1,167 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../int_write.h"
+#include "../merge_tree.h"
+#include "../radix_sort.h"
+
+/**
+ * Merge of K sorted files, the same total number of numbers split
+ * into more and more files. The linear scan over the file heads
+ * is compared with the loser tree, both merging only, and then
+ * the tree streaming into the writer to /dev/null.
+ *
+ * $> make bench
+ * $> ./bench_merge [total_count]
+ */
+
+enum {
+	DEFAULT_TOTAL_COUNT = 4 * 1000 * 1000,
+	MERGE_BATCH = 1024,
+};
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+runs_reset(struct merge_run *runs, int *data, int total, int run_count)
+{
+	for (int i = 0; i < run_count; ++i) {
+		runs[i].pos = data + (long long)total * i / run_count;
+		runs[i].end = data + (long long)total * (i + 1) / run_count;
+		runs[i].refill = NULL;
+	}
+}
+
+/** Merge by the linear scan over the heads. Returns a checksum. */
+static long long
+merge_linear(struct merge_run *runs, int run_count)
+{
+	long long sum = 0;
+	long long prev = INT64_MIN;
+	while (true) {
+		int best = -1;
+		for (int i = 0; i < run_count; ++i) {
+			if (runs[i].pos < runs[i].end &&
+			    (best < 0 || *runs[i].pos < *runs[best].pos))
+				best = i;
+		}
+		if (best < 0)
+			break;
+		int v = *runs[best].pos++;
+		if (v < prev)
+			abort();
+		prev = v;
+		sum += v;
+	}
+	return sum;
+}
+
+static long long
+merge_tree(struct merge_run *runs, int run_count)
+{
+	struct merge_tree tree;
+	merge_tree_create(&tree, runs, run_count);
+	int batch[MERGE_BATCH];
+	size_t count;
+	long long sum = 0;
+	long long prev = INT64_MIN;
+	while ((count = merge_tree_next(&tree, batch, MERGE_BATCH)) > 0) {
+		for (size_t i = 0; i < count; ++i) {
+			if (batch[i] < prev)
+				abort();
+			prev = batch[i];
+			sum += batch[i];
+		}
+	}
+	merge_tree_destroy(&tree);
+	return sum;
+}
+
+static void
+merge_tree_write(struct merge_run *runs, int run_count, int fd)
+{
+	struct merge_tree tree;
+	merge_tree_create(&tree, runs, run_count);
+	struct int_writer writer;
+	int_writer_create(&writer, fd);
+	int batch[MERGE_BATCH];
+	size_t count;
+	while ((count = merge_tree_next(&tree, batch, MERGE_BATCH)) > 0) {
+		if (int_writer_put(&writer, batch, count) != 0)
+			abort();
+	}
+	if (int_writer_flush(&writer) != 0)
+		abort();
+	int_writer_destroy(&writer);
+	merge_tree_destroy(&tree);
+}
+
+int
+main(int argc, char **argv)
+{
+	int total = DEFAULT_TOTAL_COUNT;
+	if (argc > 1)
+		total = atoi(argv[1]);
+	int *data = malloc(sizeof(int) * total);
+	int *tmp = malloc(sizeof(int) * total);
+	int fd = open("/dev/null", O_WRONLY);
+	printf("%d numbers\n", total);
+	printf("%6s %14s %14s %14s\n", "files", "linear, ms", "tree, ms",
+	       "tree+write, ms");
+	srand(1);
+	for (int run_count = 2; run_count <= 8192; run_count *= 4) {
+		struct merge_run *runs = malloc(sizeof(runs[0]) * run_count);
+		for (int i = 0; i < total; ++i)
+			data[i] = rand();
+		runs_reset(runs, data, total, run_count);
+		/* Sort each run. */
+		for (int i = 0; i < run_count; ++i) {
+			int *pos = (int *)runs[i].pos;
+			int count = runs[i].end - runs[i].pos;
+			int *res = radix_sort(pos, tmp, count);
+			if (res != pos) {
+				for (int j = 0; j < count; ++j)
+					pos[j] = res[j];
+			}
+		}
+		double linear = -1;
+		long long sum_linear = 0;
+		/* The linear scan would take minutes on many files. */
+		if (run_count <= 128) {
+			long long start = now_ns();
+			sum_linear = merge_linear(runs, run_count);
+			linear = (now_ns() - start) / 1000000.0;
+		}
+		runs_reset(runs, data, total, run_count);
+		long long start = now_ns();
+		long long sum_tree = merge_tree(runs, run_count);
+		double tree = (now_ns() - start) / 1000000.0;
+		if (linear >= 0 && sum_tree != sum_linear)
+			abort();
+		runs_reset(runs, data, total, run_count);
+		start = now_ns();
+		merge_tree_write(runs, run_count, fd);
+		double write = (now_ns() - start) / 1000000.0;
+		if (linear >= 0)
+			printf("%6d %14.3f %14.3f %14.3f\n", run_count, linear,
+			       tree, write);
+		else
+			printf("%6d %14s %14.3f %14.3f\n", run_count, "-",
+			       tree, write);
+		free(runs);
+	}
+	close(fd);
+	free(tmp);
+	free(data);
+	return 0;
+}
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../libcoro.h"
+
+/**
+ * HW1 sort on the M:N scheduler. Each file is sorted by its own
+ * coroutine with a quick sort which yields on every partition. The
+ * same files are sorted by the single-threaded scheduler and then
+ * by the M:N scheduler with 1 to N worker threads. Without files
+ * in the command line random ones are generated in memory.
+ *
+ * $> make bench
+ * $> ./bench_mt_sort [-t max_threads] [file...]
+ */
+
+enum {
+	GEN_FILE_COUNT = 32,
+	GEN_NUMBER_COUNT = 200 * 1000,
+};
+
+struct sort_file {
+	int *src;
+	int *data;
+	int count;
+};
+
+static void
+quick_sort(int *data, int left, int right)
+{
+	while (left < right) {
+		coro_yield();
+		int pivot = data[left + (right - left) / 2];
+		int i = left, j = right;
+		while (i <= j) {
+			while (data[i] < pivot)
+				++i;
+			while (data[j] > pivot)
+				--j;
+			if (i <= j) {
+				int tmp = data[i];
+				data[i++] = data[j];
+				data[j--] = tmp;
+			}
+		}
+		/* Recurse into the smaller part, loop over the bigger. */
+		if (j - left < right - i) {
+			quick_sort(data, left, j);
+			left = i;
+		} else {
+			quick_sort(data, i, right);
+			right = j;
+		}
+	}
+}
+
+static int
+sort_f(void *arg)
+{
+	struct sort_file *f = arg;
+	quick_sort(f->data, 0, f->count - 1);
+	return 0;
+}
+
+static int
+file_load(struct sort_file *f, const char *name)
+{
+	FILE *in = fopen(name, "r");
+	if (in == NULL)
+		return -1;
+	int capacity = 1024;
+	f->count = 0;
+	f->src = malloc(capacity * sizeof(int));
+	int v;
+	while (fscanf(in, "%d", &v) == 1) {
+		if (f->count == capacity) {
+			capacity *= 2;
+			f->src = realloc(f->src, capacity * sizeof(int));
+		}
+		f->src[f->count++] = v;
+	}
+	fclose(in);
+	return 0;
+}
+
+static void
+file_generate(struct sort_file *f)
+{
+	f->count = GEN_NUMBER_COUNT;
+	f->src = malloc(f->count * sizeof(int));
+	for (int i = 0; i < f->count; ++i)
+		f->src[i] = rand();
+}
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+files_reset(struct sort_file *files, int count)
+{
+	for (int i = 0; i < count; ++i)
+		memcpy(files[i].data, files[i].src, files[i].count * sizeof(int));
+}
+
+static void
+files_check(const struct sort_file *files, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		for (int j = 1; j < files[i].count; ++j) {
+			if (files[i].data[j - 1] > files[i].data[j]) {
+				printf("File %d is not sorted\n", i);
+				exit(-1);
+			}
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		if (opt != 't') {
+			printf("Usage: %s [-t max_threads] [file...]\n", argv[0]);
+			return -1;
+		}
+		max_threads = atoi(optarg);
+	}
+	int file_count = argc - optind;
+	if (file_count == 0)
+		file_count = GEN_FILE_COUNT;
+	struct sort_file *files = calloc(file_count, sizeof(*files));
+	for (int i = 0; i < file_count; ++i) {
+		struct sort_file *f = &files[i];
+		if (optind == argc) {
+			file_generate(f);
+		} else if (file_load(f, argv[optind + i]) != 0) {
+			printf("Can't read %s\n", argv[optind + i]);
+			return -1;
+		}
+		f->data = malloc(f->count * sizeof(int));
+	}
+	coro_sched_init();
+
+	files_reset(files, file_count);
+	long long start = now_ns();
+	for (int i = 0; i < file_count; ++i)
+		coro_new(sort_f, &files[i]);
+	struct coro *c;
+	while ((c = coro_sched_wait()) != NULL)
+		coro_delete(c);
+	long long base = now_ns() - start;
+	files_check(files, file_count);
+	printf("single-threaded: %9.3f ms\n", base / 1000000.0);
+
+	for (int threads = 1; threads <= max_threads; ++threads) {
+		files_reset(files, file_count);
+		start = now_ns();
+		struct coro_mt_sched *mt = coro_mt_sched_new(threads);
+		for (int i = 0; i < file_count; ++i)
+			coro_mt_new(mt, sort_f, &files[i]);
+		while ((c = coro_mt_wait(mt)) != NULL)
+			coro_delete(c);
+		long long steals = coro_mt_sched_steal_count(mt);
+		coro_mt_sched_delete(mt);
+		long long duration = now_ns() - start;
+		files_check(files, file_count);
+		printf("%2d threads: %9.3f ms, speedup %.2f, steals %lld\n",
+		       threads, duration / 1000000.0, (double)base / duration,
+		       steals);
+	}
+
+	for (int i = 0; i < file_count; ++i) {
+		free(files[i].src);
+		free(files[i].data);
+	}
+	free(files);
+	coro_sched_destroy();
+	return 0;
+}
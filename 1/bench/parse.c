@@ -0,0 +1,162 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../int_parse.h"
+
+/**
+ * Integer text parsing benchmark. Files like the ones generator.py
+ * makes are read with fscanf(), with read() and strtol(), and with
+ * read() and int_parse(). The time includes reading the file.
+ *
+ * $> make bench
+ * $> ./bench_parse
+ */
+
+enum {
+	REPEAT_COUNT = 20,
+};
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Write @a count random numbers up to @a max like generator.py. */
+static void
+make_file(const char *path, int count, long long max)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	for (int i = 0; i < count; ++i) {
+		long long v = ((long long)rand() << 16 ^ rand()) % (max + 1);
+		fprintf(f, i + 1 != count ? "%lld " : "%lld", v);
+	}
+	fclose(f);
+}
+
+/** Read the whole file. */
+static char *
+read_file(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		exit(1);
+	}
+	off_t len = lseek(fd, 0, SEEK_END);
+	char *buf = malloc(len + 1);
+	if (pread(fd, buf, len, 0) != len) {
+		perror("pread");
+		exit(1);
+	}
+	close(fd);
+	buf[len] = 0;
+	*size = len;
+	return buf;
+}
+
+static size_t
+parse_fscanf(const char *path, int *out)
+{
+	FILE *f = fopen(path, "r");
+	size_t count = 0;
+	while (fscanf(f, "%d", &out[count]) == 1)
+		++count;
+	fclose(f);
+	return count;
+}
+
+static size_t
+parse_strtol(const char *path, int *out)
+{
+	size_t size;
+	char *buf = read_file(path, &size);
+	char *pos = buf;
+	size_t count = 0;
+	while (true) {
+		char *next;
+		long v = strtol(pos, &next, 10);
+		if (next == pos)
+			break;
+		out[count++] = v;
+		pos = next;
+	}
+	free(buf);
+	return count;
+}
+
+static size_t
+parse_int_parse(const char *path, int *out)
+{
+	size_t size;
+	char *buf = read_file(path, &size);
+	const char *pos = buf;
+	size_t count = int_parse(&pos, buf + size, out,
+				 int_parse_max_count(size));
+	free(buf);
+	return count;
+}
+
+static void
+run(const char *path, int count, long long max)
+{
+	make_file(path, count, max);
+	int *out = malloc(sizeof(int) * count);
+	int *check = malloc(sizeof(int) * count);
+	struct {
+		const char *name;
+		size_t (*func)(const char *, int *);
+	} methods[] = {
+		{"fscanf", parse_fscanf},
+		{"read+strtol", parse_strtol},
+		{"read+int_parse", parse_int_parse},
+	};
+	printf("%d numbers up to %lld:\n", count, max);
+	parse_fscanf(path, check);
+	for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); ++m) {
+		long long start = now_ns();
+		for (int i = 0; i < REPEAT_COUNT; ++i) {
+			if (methods[m].func(path, out) != (size_t)count ||
+			    memcmp(out, check, sizeof(int) * count) != 0) {
+				printf("%s: wrong result\n", methods[m].name);
+				exit(1);
+			}
+		}
+		double ns = (double)(now_ns() - start) / REPEAT_COUNT;
+		printf("  %-16s %8.3f ms per file, %6.2f ns per number\n",
+		       methods[m].name, ns / 1000000, ns / count);
+	}
+	free(check);
+	free(out);
+	unlink(path);
+}
+
+int
+main(void)
+{
+	char path[] = "/tmp/bench_parse_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	srand(1);
+	int counts[] = {40000, 100000};
+	long long maxes[] = {10000, (1LL << 31) - 1};
+	for (int i = 0; i < 2; ++i) {
+		for (int j = 0; j < 2; ++j)
+			run(path, counts[i], maxes[j]);
+	}
+	return 0;
+}
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../libcoro.h"
+#include "../radix_sort.h"
+
+/**
+ * Radix sort against the quick sort in coroutines, the way the
+ * sorting task uses them: each file is sorted by its own coroutine,
+ * and with the target latency T each of N coroutines yields after
+ * T / N microseconds. The quick sort checks the quantum on each
+ * partition, the radix sort on each step.
+ *
+ * $> make bench
+ * $> ./bench_radix
+ */
+
+enum {
+	/** Like in the task example: 5 files of 10k and one of 100k. */
+	SMALL_FILE_COUNT = 5,
+	SMALL_FILE_SIZE = 10 * 1000,
+	BIG_FILE_SIZE = 100 * 1000,
+	FILE_COUNT = SMALL_FILE_COUNT + 1,
+	REPEAT_COUNT = 10,
+};
+
+struct sort_file {
+	int *src;
+	int *data;
+	int *tmp;
+	int *result;
+	int count;
+};
+
+static void
+quick_sort(int *data, int left, int right)
+{
+	while (left < right) {
+		coro_yield_if_quantum_expired();
+		int pivot = data[left + (right - left) / 2];
+		int i = left, j = right;
+		while (i <= j) {
+			while (data[i] < pivot)
+				++i;
+			while (data[j] > pivot)
+				--j;
+			if (i <= j) {
+				int tmp = data[i];
+				data[i++] = data[j];
+				data[j--] = tmp;
+			}
+		}
+		if (j - left < right - i) {
+			quick_sort(data, left, j);
+			left = i;
+		} else {
+			quick_sort(data, i, right);
+			right = j;
+		}
+	}
+}
+
+static int
+quick_sort_f(void *arg)
+{
+	struct sort_file *f = arg;
+	quick_sort(f->data, 0, f->count - 1);
+	f->result = f->data;
+	return 0;
+}
+
+static int
+radix_sort_f(void *arg)
+{
+	struct sort_file *f = arg;
+	struct radix_sort s;
+	radix_sort_create(&s, f->data, f->tmp, f->count);
+	while (! radix_sort_step(&s, RADIX_SORT_STEP_DEFAULT))
+		coro_yield_if_quantum_expired();
+	f->result = radix_sort_result(&s);
+	return 0;
+}
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Sort all the files. Returns time in ns, counts the switches. */
+static long long
+run(struct sort_file *files, coro_f func, long long *switches)
+{
+	for (int i = 0; i < FILE_COUNT; ++i) {
+		memcpy(files[i].data, files[i].src,
+		       files[i].count * sizeof(int));
+	}
+	long long start = now_ns();
+	for (int i = 0; i < FILE_COUNT; ++i)
+		coro_new(func, &files[i]);
+	struct coro *c;
+	while ((c = coro_sched_wait()) != NULL) {
+		*switches += coro_switch_count(c);
+		coro_delete(c);
+	}
+	long long duration = now_ns() - start;
+	for (int i = 0; i < FILE_COUNT; ++i) {
+		for (int j = 1; j < files[i].count; ++j) {
+			if (files[i].result[j - 1] > files[i].result[j]) {
+				printf("File %d is not sorted\n", i);
+				exit(1);
+			}
+		}
+	}
+	return duration;
+}
+
+static void
+run_all(struct sort_file *files, long long max)
+{
+	for (int i = 0; i < FILE_COUNT; ++i) {
+		for (int j = 0; j < files[i].count; ++j)
+			files[i].src[j] = ((long long)rand() << 16 ^ rand()) %
+					  (max + 1) - (max > 10000 ? max / 2 : 0);
+	}
+	printf("numbers up to %lld\n", max);
+	printf("%8s %12s %12s %12s %12s\n", "-l, us", "quick, ms",
+	       "switches", "radix, ms", "switches");
+	long long latencies[] = {0, 10, 100, 1000, 10000};
+	for (size_t l = 0; l < sizeof(latencies) / sizeof(latencies[0]);
+	     ++l) {
+		coro_sched_set_quantum(latencies[l] * 1000 / FILE_COUNT);
+		long long quick = 0, radix = 0;
+		long long quick_switches = 0, radix_switches = 0;
+		for (int r = 0; r < REPEAT_COUNT; ++r) {
+			quick += run(files, quick_sort_f, &quick_switches);
+			radix += run(files, radix_sort_f, &radix_switches);
+		}
+		printf("%8lld %12.3f %12lld %12.3f %12lld\n", latencies[l],
+		       quick / 1000000.0 / REPEAT_COUNT,
+		       quick_switches / REPEAT_COUNT,
+		       radix / 1000000.0 / REPEAT_COUNT,
+		       radix_switches / REPEAT_COUNT);
+	}
+}
+
+int
+main(void)
+{
+	coro_sched_init();
+	struct sort_file files[FILE_COUNT];
+	for (int i = 0; i < FILE_COUNT; ++i) {
+		struct sort_file *f = &files[i];
+		f->count = i < SMALL_FILE_COUNT ? SMALL_FILE_SIZE :
+			   BIG_FILE_SIZE;
+		f->src = malloc(f->count * sizeof(int));
+		f->data = malloc(f->count * sizeof(int));
+		f->tmp = malloc(f->count * sizeof(int));
+	}
+	srand(1);
+	run_all(files, 10000);
+	run_all(files, (1LL << 32) - 1);
+	for (int i = 0; i < FILE_COUNT; ++i) {
+		free(files[i].src);
+		free(files[i].data);
+		free(files[i].tmp);
+	}
+	coro_sched_destroy();
+	return 0;
+}
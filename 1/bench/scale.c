@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../libcoro.h"
+
+/**
+ * Scheduler scaling benchmark. N coroutines yield a few times each
+ * and finish at different moments, and the main coroutine reaps
+ * them as they finish. With O(1) yield and reap the time per
+ * operation should not depend on N.
+ *
+ * $> make bench
+ * $> ./bench_scale [max coroutine count]
+ */
+
+enum {
+	DEFAULT_MAX_CORO_COUNT = 10 * 1000,
+	YIELD_COUNT = 100,
+};
+
+static int
+yield_loop_f(void *arg)
+{
+	long long count = (long long)(size_t)arg;
+	for (long long i = 0; i < count; ++i)
+		coro_yield();
+	return 0;
+}
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bench_run(int coro_count)
+{
+	coro_sched_set_stack_size(64 * 1024);
+	coro_sched_set_stack_cache_size(coro_count);
+	for (int i = 0; i < coro_count; ++i) {
+		/* Finish in different rounds - reaping is spread out. */
+		size_t count = YIELD_COUNT / 2 + i % YIELD_COUNT;
+		coro_new(yield_loop_f, (void *)count);
+	}
+	long long start = now_ns();
+	long long switches = 0;
+	struct coro *c;
+	while ((c = coro_sched_wait()) != NULL) {
+		switches += coro_switch_count(c);
+		coro_delete(c);
+	}
+	long long duration = now_ns() - start;
+	printf("%7d coroutines: %10.3f ms, %lld switches, %.2f ns per "
+	       "switch\n", coro_count, duration / 1000000.0, switches,
+	       (double)duration / switches);
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_count = DEFAULT_MAX_CORO_COUNT;
+	if (argc > 1)
+		max_count = atoi(argv[1]);
+	coro_sched_init();
+	for (int count = 10; count <= max_count; count *= 10)
+		bench_run(count);
+	coro_sched_destroy();
+	return 0;
+}
@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Benchmark driver of the sorter. For each file count and size of
+ * the matrix the files are made by bench_gen, then the sorter is run
+ * on them with each -n and -l. The result is CSV, a row per
+ * coroutine of each run: the run parameters, the total time of the
+ * run, and the process (with -p), the time, the switch count and
+ * the file count of the coroutine. The lists are comma separated,
+ * -n 0 means one coroutine per file. -a passes more sorter options,
+ * like "-p 2".
+ *
+ * $> make && make bench
+ * $> ./bench_sorter [-F 1,4,16] [-c 10000,100000] [-n 1,4] [-l 100,10000]
+ *	[-d random] [-a options] [-o out.csv]
+ */
+
+enum {
+	LIST_MAX = 16,
+	ARG_MAX_COUNT = 64,
+	OUTPUT_MAX = 1024 * 1024,
+};
+
+struct list {
+	long long values[LIST_MAX];
+	int count;
+};
+
+static int
+list_parse(struct list *l, const char *str)
+{
+	l->count = 0;
+	while (*str != 0) {
+		if (l->count == LIST_MAX)
+			return -1;
+		char *end;
+		l->values[l->count++] = strtoll(str, &end, 10);
+		if (end == str || (*end != ',' && *end != 0))
+			return -1;
+		str = *end == ',' ? end + 1 : end;
+	}
+	return l->count > 0 ? 0 : -1;
+}
+
+/**
+ * Run a program in @a dir and take its stdout. Returns the exit
+ * status, -1 if it could not be run.
+ */
+static int
+run(const char *dir, char **argv, char *out, size_t size)
+{
+	int fd[2];
+	if (pipe(fd) != 0)
+		return -1;
+	pid_t pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		close(fd[0]);
+		dup2(fd[1], STDOUT_FILENO);
+		if (chdir(dir) != 0)
+			_exit(127);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	close(fd[1]);
+	size_t done = 0;
+	ssize_t rc;
+	while ((rc = read(fd[0], out + done, size - 1 - done)) != 0) {
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			break;
+		done += rc;
+		if (done == size - 1) {
+			/* Drop the rest, it is not needed. */
+			char buf[4096];
+			while (read(fd[0], buf, sizeof(buf)) > 0);
+			break;
+		}
+	}
+	out[done] = 0;
+	close(fd[0]);
+	int status;
+	if (waitpid(pid, &status, 0) != pid || ! WIFEXITED(status))
+		return -1;
+	return WEXITSTATUS(status);
+}
+
+/** Split the options string by spaces into @a argv. */
+static int
+args_split(char *str, char **argv, int max)
+{
+	int count = 0;
+	for (char *tok = strtok(str, " "); tok != NULL && count < max;
+	     tok = strtok(NULL, " "))
+		argv[count++] = tok;
+	return count;
+}
+
+/** The line after @a line, NULL if none. */
+static const char *
+line_next(const char *line)
+{
+	line = strchr(line, '\n');
+	return line != NULL && line[1] != 0 ? line + 1 : NULL;
+}
+
+/** Make the test files test0.txt, test1.txt, ... in @a dir. */
+static int
+files_make(const char *dir, char *gen, int file_count, long long size,
+	   const char *dist, char *output)
+{
+	char count[32];
+	snprintf(count, sizeof(count), "%lld", size);
+	for (int i = 0; i < file_count; ++i) {
+		char name[32];
+		char seed[32];
+		snprintf(name, sizeof(name), "test%d.txt", i);
+		snprintf(seed, sizeof(seed), "%d", i + 1);
+		char *argv[] = {gen, "-f", name, "-c", count, "-d",
+				(char *)dist, "-s", seed, NULL};
+		if (run(dir, argv, output, OUTPUT_MAX) != 0) {
+			fprintf(stderr, "bench_gen failed\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** Parameters of a sorter run. */
+struct bench {
+	int file_count;
+	long long size;
+	const char *dist;
+	long long coro_count;
+	long long latency;
+};
+
+/**
+ * Run the sorter on the test files and print the CSV rows. The
+ * sorter output is parsed - a line per coroutine and the total.
+ */
+static int
+bench_run(FILE *out, const char *dir, char *sorter, const char *extra,
+	  const struct bench *b, char *output)
+{
+	char **argv = malloc(sizeof(argv[0]) *
+			     (ARG_MAX_COUNT + b->file_count + 4));
+	char *extra_copy = strdup(extra != NULL ? extra : "");
+	int argc = 0;
+	argv[argc++] = sorter;
+	argc += args_split(extra_copy, argv + argc, ARG_MAX_COUNT);
+	char coro_arg[32];
+	char latency_arg[32];
+	snprintf(coro_arg, sizeof(coro_arg), "-n%lld", b->coro_count);
+	snprintf(latency_arg, sizeof(latency_arg), "-l%lld", b->latency);
+	if (b->coro_count != 0)
+		argv[argc++] = coro_arg;
+	argv[argc++] = latency_arg;
+	char (*names)[32] = malloc(sizeof(names[0]) * b->file_count);
+	for (int i = 0; i < b->file_count; ++i) {
+		snprintf(names[i], sizeof(names[i]), "test%d.txt", i);
+		argv[argc++] = names[i];
+	}
+	argv[argc] = NULL;
+	int rc = run(dir, argv, output, OUTPUT_MAX);
+	free(names);
+	free(extra_copy);
+	free(argv);
+	double total = -1;
+	for (const char *l = output; rc == 0 && l != NULL; l = line_next(l))
+		sscanf(l, "total: %lf ms", &total);
+	if (rc != 0 || total < 0) {
+		fprintf(stderr, "the sorter failed: %s\n", output);
+		return -1;
+	}
+	for (const char *l = output; l != NULL; l = line_next(l)) {
+		int proc = 0, coro, files, len = 0;
+		double ms;
+		long long switches;
+		/* In the -p mode the coroutine goes after its process. */
+		sscanf(l, "proc %d %n", &proc, &len);
+		if (sscanf(l + len, "coro %d: %d files, %lf ms, %lld switches",
+			   &coro, &files, &ms, &switches) != 4)
+			continue;
+		fprintf(out, "%d,%lld,%s,%lld,%lld,%.3f,%d,%d,%d,%.3f,%lld\n",
+			b->file_count, b->size, b->dist, b->coro_count,
+			b->latency, total, proc, coro, files, ms, switches);
+	}
+	fflush(out);
+	return 0;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-F file_counts] [-c number_counts] "
+		"[-n coro_counts] [-l latencies_us] [-d distribution] "
+		"[-a sorter_options] [-o out.csv]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct list files = {{1, 4, 16}, 3};
+	struct list sizes = {{10000, 100000}, 2};
+	struct list coros = {{1, 4}, 2};
+	struct list latencies = {{100, 10000}, 2};
+	const char *dist = "random";
+	char *extra = NULL;
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "F:c:n:l:d:a:o:")) != -1) {
+		int rc = 0;
+		switch (opt) {
+		case 'F':
+			rc = list_parse(&files, optarg);
+			break;
+		case 'c':
+			rc = list_parse(&sizes, optarg);
+			break;
+		case 'n':
+			rc = list_parse(&coros, optarg);
+			break;
+		case 'l':
+			rc = list_parse(&latencies, optarg);
+			break;
+		case 'd':
+			dist = optarg;
+			break;
+		case 'a':
+			extra = strdup(optarg);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			rc = -1;
+			break;
+		}
+		if (rc != 0) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	FILE *out = out_path == NULL ? stdout : fopen(out_path, "w");
+	if (out == NULL) {
+		perror(out_path);
+		return 1;
+	}
+	char sorter[PATH_MAX];
+	char gen[PATH_MAX];
+	if (realpath("a.out", sorter) == NULL ||
+	    realpath("bench_gen", gen) == NULL) {
+		fprintf(stderr, "a.out and bench_gen should be built\n");
+		return 1;
+	}
+	char dir[] = "/tmp/bench_sorter_XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char *output = malloc(OUTPUT_MAX);
+	fprintf(out, "files,numbers,distribution,coro_count,latency_us,"
+		"total_ms,proc,coro,coro_files,coro_ms,switches\n");
+	int rc = 0;
+	struct bench b;
+	b.dist = dist;
+	for (int fi = 0; fi < files.count && rc == 0; ++fi) {
+		b.file_count = files.values[fi];
+		for (int si = 0; si < sizes.count && rc == 0; ++si) {
+			b.size = sizes.values[si];
+			rc = files_make(dir, gen, b.file_count, b.size, dist,
+					output);
+			for (int ci = 0; ci < coros.count && rc == 0; ++ci) {
+				b.coro_count = coros.values[ci];
+				for (int li = 0; li < latencies.count &&
+				     rc == 0; ++li) {
+					b.latency = latencies.values[li];
+					rc = bench_run(out, dir, sorter, extra,
+						       &b, output);
+				}
+			}
+		}
+	}
+	char cmd[PATH_MAX + 16];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+	if (system(cmd) != 0)
+		fprintf(stderr, "could not remove %s\n", dir);
+	if (out != stdout)
+		fclose(out);
+	free(output);
+	free(extra);
+	return rc == 0 ? 0 : 1;
+}
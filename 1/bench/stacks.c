@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../libcoro.h"
+
+/**
+ * Memory of lots of mostly idle coroutines with the usual and with
+ * the small stacks. A few coroutines of each generation go deep
+ * once, the others use little stack. All of them then idle for
+ * some rounds of yields. The second generation reuses the cached
+ * stacks of the first one.
+ *
+ * Each stack takes two memory mappings, so 100k coroutines need
+ * vm.max_map_count above the default 65530:
+ *
+ * $> sysctl -w vm.max_map_count=262144
+ * $> make bench
+ * $> ./bench_stacks [coro_count]
+ */
+
+enum {
+	DEFAULT_CORO_COUNT = 100 * 1000,
+	/** Each DEEP_EVERY-th coroutine goes deep. */
+	DEEP_EVERY = 100,
+	DEEP_SIZE = 256 * 1024,
+	SHALLOW_SIZE = 2 * 1024,
+	IDLE_ROUNDS = 3,
+	FRAME_SIZE = 512,
+};
+
+/** Use about @a size bytes of the stack. */
+static int __attribute__((noinline))
+stack_eat(int size)
+{
+	volatile char frame[FRAME_SIZE];
+	memset((char *)frame, size, sizeof(frame));
+	if (size <= FRAME_SIZE)
+		return frame[0];
+	return stack_eat(size - FRAME_SIZE) + frame[1];
+}
+
+static int
+idle_f(void *arg)
+{
+	int size = (int)(long)arg;
+	int rc = stack_eat(size);
+	for (int i = 0; i < IDLE_ROUNDS; ++i)
+		coro_yield();
+	return rc;
+}
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Resident memory of the process in MiB. */
+static double
+rss_mib(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	long size = 0, resident = 0;
+	if (f != NULL) {
+		if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return (double)resident * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+/** Run a generation of coroutines, report the peak memory. */
+static void
+run_generation(const char *name, int count, bool has_deep)
+{
+	long long start = now_ns();
+	for (int i = 0; i < count; ++i) {
+		long size = has_deep && i % DEEP_EVERY == 0 ?
+			    DEEP_SIZE : SHALLOW_SIZE;
+		coro_new(idle_f, (void *)size);
+	}
+	/* All of them have started and idle when the first ends. */
+	struct coro *c = coro_sched_wait();
+	double rss = rss_mib();
+	do {
+		coro_delete(c);
+	} while ((c = coro_sched_wait()) != NULL);
+	long long duration = now_ns() - start;
+	printf("  %-10s %8.1f MiB RSS with all alive, %8.1f ms\n", name,
+	       rss, duration / 1000000.0);
+}
+
+static void
+run(const char *name, int count, size_t small_size)
+{
+	coro_sched_set_stack_small_size(small_size);
+	double rss = rss_mib();
+	printf("%s stacks, %d coroutines, %.1f MiB RSS before\n", name,
+	       count, rss);
+	run_generation("deep mix", count, true);
+	run_generation("shallow", count, false);
+	struct coro_stack_stat stat;
+	coro_sched_stack_stat(&stat);
+	if (stat.deleted > 0) {
+		printf("  high-water mark avg %lld KiB, max %lld KiB\n",
+		       stat.used_total / stat.deleted / 1024,
+		       stat.used_max / 1024);
+	}
+	coro_sched_destroy();
+	coro_sched_init();
+	coro_sched_set_stack_cache_size(count);
+}
+
+int
+main(int argc, char **argv)
+{
+	int count = DEFAULT_CORO_COUNT;
+	if (argc > 1)
+		count = atoi(argv[1]);
+	coro_sched_init();
+	/* Both generations reuse the same stacks. */
+	coro_sched_set_stack_cache_size(count);
+	run("1 MiB", count, 0);
+	run("16 KiB small", count, CORO_STACK_SMALL_SIZE);
+	coro_sched_destroy();
+	return 0;
+}
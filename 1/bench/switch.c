@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../libcoro.h"
+
+/**
+ * Context switch microbenchmark. Several coroutines just yield to
+ * each other in a loop. Build it with the default backend and with
+ * -DCORO_USE_SIGJMP=1 to compare them:
+ *
+ * $> make bench
+ * $> ./bench_switch; ./bench_switch_sigjmp
+ */
+
+enum {
+	CORO_COUNT = 2,
+	DEFAULT_YIELD_COUNT = 10 * 1000 * 1000,
+};
+
+static int
+yield_loop_f(void *arg)
+{
+	long long count = *(long long *)arg;
+	for (long long i = 0; i < count; ++i)
+		coro_yield();
+	return 0;
+}
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+	long long count = DEFAULT_YIELD_COUNT;
+	if (argc > 1)
+		count = atoll(argv[1]);
+	coro_sched_init();
+	for (int i = 0; i < CORO_COUNT; ++i)
+		coro_new(yield_loop_f, &count);
+
+	long long start = now_ns();
+	long long switches = 0;
+	struct coro *c;
+	while ((c = coro_sched_wait()) != NULL) {
+		switches += coro_switch_count(c);
+		coro_delete(c);
+	}
+	long long duration = now_ns() - start;
+	printf("backend: %s\n", CORO_USE_SIGJMP ? "sigjmp" : "asm");
+	printf("switches: %lld\n", switches);
+	printf("total: %.3f ms\n", duration / 1000000.0);
+	printf("per switch: %.2f ns\n", (double)duration / switches);
+	return 0;
+}
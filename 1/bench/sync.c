@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../libcoro.h"
+#include "../coro_sync.h"
+
+/**
+ * Synchronization primitives against polling with coro_yield().
+ * Each scenario is run both ways, the time and the total number of
+ * switches are reported.
+ *
+ * $> make bench
+ * $> ./bench_sync
+ */
+
+enum {
+	MSG_COUNT = 1000 * 1000,
+	QUEUE_CAPACITY = 16,
+	PRODUCER_COUNT = 4,
+	CONSUMER_COUNT = 4,
+	WAITER_COUNT = 1000,
+	WORK_STEPS = 10 * 1000,
+	LOCKER_COUNT = 100,
+	LOCK_ROUNDS = 100,
+	LOCK_HOLD_YIELDS = 10,
+};
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bench_run(const char *name, coro_f func, void **args, int count)
+{
+	long long start = now_ns();
+	for (int i = 0; i < count; ++i)
+		coro_new(func, args[i]);
+	long long switches = 0;
+	struct coro *c;
+	while ((c = coro_sched_wait()) != NULL) {
+		switches += coro_switch_count(c);
+		coro_delete(c);
+	}
+	long long duration = now_ns() - start;
+	printf("%-24s %10.3f ms, %10lld switches\n", name,
+	       duration / 1000000.0, switches);
+}
+
+/** Producers and consumers, via a channel. */
+
+static int
+channel_producer_f(void *arg)
+{
+	struct coro_channel *ch = arg;
+	for (long i = 0; i < MSG_COUNT / PRODUCER_COUNT; ++i)
+		coro_channel_put(ch, (void *)i);
+	return 0;
+}
+
+static int
+channel_consumer_f(void *arg)
+{
+	struct coro_channel *ch = arg;
+	void *msg;
+	while (coro_channel_get(ch, &msg) == 0)
+		;
+	return 0;
+}
+
+/** The same via a ring buffer polled with yields. */
+
+struct poll_queue {
+	long msgs[QUEUE_CAPACITY];
+	int head;
+	int count;
+	int producers_left;
+};
+
+static int
+poll_producer_f(void *arg)
+{
+	struct poll_queue *q = arg;
+	for (long i = 0; i < MSG_COUNT / PRODUCER_COUNT; ++i) {
+		while (q->count == QUEUE_CAPACITY)
+			coro_yield();
+		q->msgs[(q->head + q->count++) % QUEUE_CAPACITY] = i;
+	}
+	--q->producers_left;
+	return 0;
+}
+
+static int
+poll_consumer_f(void *arg)
+{
+	struct poll_queue *q = arg;
+	while (true) {
+		while (q->count == 0) {
+			if (q->producers_left == 0)
+				return 0;
+			coro_yield();
+		}
+		q->head = (q->head + 1) % QUEUE_CAPACITY;
+		--q->count;
+	}
+}
+
+/** Many coroutines wait for one doing some work. */
+
+struct wait_ctx {
+	struct coro_wait_group wg;
+	bool is_done;
+};
+
+static int
+wg_worker_f(void *arg)
+{
+	struct wait_ctx *ctx = arg;
+	for (int i = 0; i < WORK_STEPS; ++i)
+		coro_yield();
+	coro_wait_group_done(&ctx->wg);
+	ctx->is_done = true;
+	return 0;
+}
+
+static int
+wg_waiter_f(void *arg)
+{
+	struct wait_ctx *ctx = arg;
+	coro_wait_group_wait(&ctx->wg);
+	return 0;
+}
+
+static int
+poll_waiter_f(void *arg)
+{
+	struct wait_ctx *ctx = arg;
+	while (! ctx->is_done)
+		coro_yield();
+	return 0;
+}
+
+/** Coroutines contend for a lock held across yields. */
+
+struct lock_ctx {
+	struct coro_mutex mutex;
+	bool is_locked;
+};
+
+static int
+mutex_locker_f(void *arg)
+{
+	struct lock_ctx *ctx = arg;
+	for (int i = 0; i < LOCK_ROUNDS; ++i) {
+		coro_mutex_lock(&ctx->mutex);
+		for (int j = 0; j < LOCK_HOLD_YIELDS; ++j)
+			coro_yield();
+		coro_mutex_unlock(&ctx->mutex);
+	}
+	return 0;
+}
+
+static int
+poll_locker_f(void *arg)
+{
+	struct lock_ctx *ctx = arg;
+	for (int i = 0; i < LOCK_ROUNDS; ++i) {
+		while (ctx->is_locked)
+			coro_yield();
+		ctx->is_locked = true;
+		for (int j = 0; j < LOCK_HOLD_YIELDS; ++j)
+			coro_yield();
+		ctx->is_locked = false;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	coro_sched_init();
+	coro_sched_set_stack_size(64 * 1024);
+	coro_sched_set_stack_cache_size(WAITER_COUNT + 1);
+	void *args[WAITER_COUNT];
+
+	printf("%d producers -> %d consumers, %d messages\n",
+	       PRODUCER_COUNT, CONSUMER_COUNT, MSG_COUNT);
+	struct coro_channel *ch = coro_channel_new(QUEUE_CAPACITY);
+	struct coro *producers[PRODUCER_COUNT];
+	for (int i = 0; i < PRODUCER_COUNT; ++i)
+		producers[i] = coro_new(channel_producer_f, ch);
+	for (int i = 0; i < CONSUMER_COUNT; ++i)
+		coro_new(channel_consumer_f, ch);
+	long long start = now_ns();
+	long long switches = 0;
+	int producers_left = PRODUCER_COUNT;
+	struct coro *c;
+	while ((c = coro_sched_wait()) != NULL) {
+		for (int i = 0; i < PRODUCER_COUNT; ++i) {
+			if (c == producers[i] && --producers_left == 0)
+				coro_channel_close(ch);
+		}
+		switches += coro_switch_count(c);
+		coro_delete(c);
+	}
+	printf("%-24s %10.3f ms, %10lld switches\n", "channel",
+	       (now_ns() - start) / 1000000.0, switches);
+	coro_channel_delete(ch);
+
+	struct poll_queue q = {.producers_left = PRODUCER_COUNT};
+	for (int i = 0; i < PRODUCER_COUNT + CONSUMER_COUNT; ++i)
+		args[i] = &q;
+	for (int i = 0; i < PRODUCER_COUNT; ++i)
+		coro_new(poll_producer_f, &q);
+	bench_run("yield polling", poll_consumer_f, args, CONSUMER_COUNT);
+
+	printf("\n%d coroutines wait for one doing %d steps\n",
+	       WAITER_COUNT, WORK_STEPS);
+	struct wait_ctx wctx = {.is_done = false};
+	coro_wait_group_create(&wctx.wg);
+	coro_wait_group_add(&wctx.wg, 1);
+	for (int i = 0; i < WAITER_COUNT; ++i)
+		args[i] = &wctx;
+	coro_new(wg_worker_f, &wctx);
+	bench_run("wait group", wg_waiter_f, args, WAITER_COUNT);
+	coro_wait_group_destroy(&wctx.wg);
+	wctx.is_done = false;
+	coro_wait_group_create(&wctx.wg);
+	coro_wait_group_add(&wctx.wg, 1);
+	coro_new(wg_worker_f, &wctx);
+	bench_run("yield polling", poll_waiter_f, args, WAITER_COUNT);
+	coro_wait_group_destroy(&wctx.wg);
+
+	printf("\n%d coroutines lock %d times, holding for %d yields\n",
+	       LOCKER_COUNT, LOCK_ROUNDS, LOCK_HOLD_YIELDS);
+	struct lock_ctx lctx = {.is_locked = false};
+	coro_mutex_create(&lctx.mutex);
+	for (int i = 0; i < LOCKER_COUNT; ++i)
+		args[i] = &lctx;
+	bench_run("mutex", mutex_locker_f, args, LOCKER_COUNT);
+	coro_mutex_destroy(&lctx.mutex);
+	bench_run("yield polling", poll_locker_f, args, LOCKER_COUNT);
+
+	coro_sched_destroy();
+	return 0;
+}
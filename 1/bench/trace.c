@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../libcoro.h"
+
+/**
+ * Tracing overhead and a check of the target latency. First the
+ * switch cost is measured with and without tracing. Then N busy
+ * coroutines share the target latency T like in the sorting task -
+ * each gets a T / N quantum, so each should wait for its turn not
+ * much longer than T. The delays are printed and the trace is
+ * saved for chrome://tracing or Perfetto.
+ *
+ * $> make bench
+ * $> ./bench_trace [-l target_latency_us] [-o trace.json]
+ */
+
+enum {
+	SWITCH_COUNT = 1000 * 1000,
+	DEFAULT_LATENCY_US = 1000,
+	WORK_MS = 200,
+	TRACE_CAPACITY = 1 << 20,
+};
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+yield_loop_f(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < SWITCH_COUNT; ++i)
+		coro_yield();
+	return 0;
+}
+
+/** Switch cost in nanoseconds. */
+static double
+switch_cost(void)
+{
+	long long start = now_ns();
+	coro_new(yield_loop_f, NULL);
+	coro_new(yield_loop_f, NULL);
+	long long switches = 0;
+	struct coro *c;
+	while ((c = coro_sched_wait()) != NULL) {
+		switches += coro_switch_count(c);
+		coro_delete(c);
+	}
+	return (double)(now_ns() - start) / switches;
+}
+
+/** Busy loop, yielding when the quantum is over. */
+static int
+busy_f(void *arg)
+{
+	long long deadline = *(long long *)arg;
+	while (now_ns() < deadline)
+		coro_yield_if_quantum_expired();
+	return 0;
+}
+
+static void
+hist_merge(struct coro_delay_hist *dst, const struct coro_delay_hist *src)
+{
+	for (int i = 0; i < CORO_DELAY_HIST_SIZE; ++i)
+		dst->count[i] += src->count[i];
+	dst->total += src->total;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/** Run @a count busy coroutines, print their delays. */
+static void
+run_busy(int count, long long latency_us)
+{
+	coro_sched_set_quantum(latency_us * 1000 / count);
+	long long deadline = now_ns() + WORK_MS * 1000000LL;
+	for (int i = 0; i < count; ++i)
+		coro_new(busy_f, &deadline);
+	struct coro_delay_hist all;
+	memset(&all, 0, sizeof(all));
+	long long worst_p99 = 0;
+	struct coro *c;
+	while ((c = coro_sched_wait()) != NULL) {
+		struct coro_delay_hist hist;
+		coro_delay_hist(c, &hist);
+		hist_merge(&all, &hist);
+		long long p99 = coro_delay_hist_percentile(&hist, 99);
+		if (p99 > worst_p99)
+			worst_p99 = p99;
+		coro_delete(c);
+	}
+	printf("%5d coroutines: %8lld delays, avg %7.1f us, p50 <= %7.1f us, "
+	       "p99 <= %7.1f us, max %7.1f us, worst coro p99 <= %7.1f us\n",
+	       count, all.total, all.total == 0 ? 0 :
+	       (double)all.sum / all.total / 1000,
+	       coro_delay_hist_percentile(&all, 50) / 1000.0,
+	       coro_delay_hist_percentile(&all, 99) / 1000.0,
+	       all.max / 1000.0, worst_p99 / 1000.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	long long latency_us = DEFAULT_LATENCY_US;
+	const char *path = "trace.json";
+	int opt;
+	while ((opt = getopt(argc, argv, "l:o:")) != -1) {
+		switch (opt) {
+		case 'l':
+			latency_us = atoll(optarg);
+			break;
+		case 'o':
+			path = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-l latency_us] "
+				"[-o trace.json]\n", argv[0]);
+			return 1;
+		}
+	}
+	coro_sched_init();
+	double cost_off = switch_cost();
+	coro_trace_start(TRACE_CAPACITY);
+	double cost_on = switch_cost();
+	printf("switch: %.2f ns, traced %.2f ns\n\n", cost_off, cost_on);
+
+	printf("target latency %lld us, %d ms of work\n", latency_us,
+	       WORK_MS);
+	int counts[] = {2, 10, 100, 1000};
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+		/* The trace of the last run only. */
+		coro_trace_start(TRACE_CAPACITY);
+		run_busy(counts[i], latency_us);
+	}
+	coro_trace_stop();
+	if (coro_trace_export(path) != 0) {
+		perror("export");
+		return 1;
+	}
+	printf("\ntrace of the last run: %s\n", path);
+	coro_sched_destroy();
+	return 0;
+}
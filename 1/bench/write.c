@@ -0,0 +1,194 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../int_write.h"
+
+/**
+ * Integer text output benchmark. Random numbers are written into a
+ * file with fprintf(), with a buffered writer formatting one digit
+ * at a time, and with int_writer. Each result is compared with the
+ * fprintf() one.
+ *
+ * $> make bench
+ * $> ./bench_write
+ */
+
+enum {
+	REPEAT_COUNT = 20,
+	BUFFER_SIZE = INT_WRITER_BUFFER_SIZE,
+};
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+open_file(const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("open");
+		exit(1);
+	}
+	return fd;
+}
+
+static void
+write_fprintf(const char *path, const int *values, int count)
+{
+	FILE *f = fopen(path, "w");
+	for (int i = 0; i < count; ++i)
+		fprintf(f, i == 0 ? "%d" : " %d", values[i]);
+	fclose(f);
+}
+
+static void
+write_all(int fd, const char *buf, size_t size)
+{
+	if (write(fd, buf, size) != (ssize_t)size) {
+		perror("write");
+		exit(1);
+	}
+}
+
+/** Digits one by one into a temporary array, then copied. */
+static void
+write_digits(const char *path, const int *values, int count)
+{
+	int fd = open_file(path);
+	char *buf = malloc(BUFFER_SIZE);
+	size_t size = 0;
+	for (int i = 0; i < count; ++i) {
+		if (size + INT_WRITER_MAX_LEN > BUFFER_SIZE) {
+			write_all(fd, buf, size);
+			size = 0;
+		}
+		if (i != 0)
+			buf[size++] = ' ';
+		unsigned v = values[i];
+		if (values[i] < 0) {
+			buf[size++] = '-';
+			v = -v;
+		}
+		char digits[INT_WRITER_MAX_LEN];
+		char *p = digits + sizeof(digits);
+		do {
+			*--p = '0' + v % 10;
+			v /= 10;
+		} while (v != 0);
+		while (p < digits + sizeof(digits))
+			buf[size++] = *p++;
+	}
+	write_all(fd, buf, size);
+	free(buf);
+	close(fd);
+}
+
+static void
+write_int_writer(const char *path, const int *values, int count)
+{
+	int fd = open_file(path);
+	struct int_writer w;
+	int_writer_create(&w, fd);
+	if (int_writer_put(&w, values, count) != 0 ||
+	    int_writer_flush(&w) != 0) {
+		perror("int_writer");
+		exit(1);
+	}
+	int_writer_destroy(&w);
+	close(fd);
+}
+
+/** Read the whole file. */
+static char *
+read_file(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		exit(1);
+	}
+	off_t len = lseek(fd, 0, SEEK_END);
+	char *buf = malloc(len + 1);
+	if (pread(fd, buf, len, 0) != len) {
+		perror("pread");
+		exit(1);
+	}
+	close(fd);
+	*size = len;
+	return buf;
+}
+
+static void
+run(const char *path, int count, long long max, bool is_signed)
+{
+	int *values = malloc(sizeof(int) * count);
+	for (int i = 0; i < count; ++i) {
+		long long v = ((long long)rand() << 16 ^ rand()) % (max + 1);
+		values[i] = is_signed && rand() % 2 == 0 ? -v - 1 : v;
+	}
+	/* The edge cases of the digit count. */
+	long long p = 1;
+	for (int i = 0; i < count && p <= max; ++i, p *= 10)
+		values[i] = p - 1 + i % 2;
+	if (is_signed && count > 1) {
+		values[0] = -2147483647 - 1;
+		values[1] = 2147483647;
+	}
+	write_fprintf(path, values, count);
+	size_t check_size;
+	char *check = read_file(path, &check_size);
+	struct {
+		const char *name;
+		void (*func)(const char *, const int *, int);
+	} methods[] = {
+		{"fprintf", write_fprintf},
+		{"digit by digit", write_digits},
+		{"int_writer", write_int_writer},
+	};
+	printf("%d %snumbers up to %lld:\n", count, is_signed ? "signed " : "",
+	       max);
+	for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); ++m) {
+		long long start = now_ns();
+		for (int i = 0; i < REPEAT_COUNT; ++i)
+			methods[m].func(path, values, count);
+		double ns = (double)(now_ns() - start) / REPEAT_COUNT;
+		size_t size;
+		char *text = read_file(path, &size);
+		if (size != check_size || memcmp(text, check, size) != 0) {
+			printf("%s: wrong result\n", methods[m].name);
+			exit(1);
+		}
+		free(text);
+		printf("  %-16s %8.3f ms per file, %6.2f ns per number\n",
+		       methods[m].name, ns / 1000000, ns / count);
+	}
+	free(check);
+	free(values);
+}
+
+int
+main(void)
+{
+	char path[] = "/tmp/bench_write_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	srand(1);
+	run(path, 600000, 10000, false);
+	run(path, 600000, (1LL << 31) - 1, false);
+	run(path, 600000, (1LL << 31) - 1, true);
+	unlink(path);
+	return 0;
+}
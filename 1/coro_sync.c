@@ -0,0 +1,283 @@
+#include "coro_sync.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include "libcoro.h"
+
+/**
+ * A waiting coroutine. Lives on the waiter's stack, so waiting
+ * doesn't allocate anything.
+ */
+struct coro_waiter {
+	struct coro *coro;
+	/** True, when somebody has woken the waiter up. */
+	bool is_woken;
+	struct coro_waiter *next;
+};
+
+static void
+coro_wait_queue_create(struct coro_wait_queue *q)
+{
+	q->first = NULL;
+	q->last = NULL;
+}
+
+static struct coro_waiter *
+coro_wait_queue_pop(struct coro_wait_queue *q)
+{
+	struct coro_waiter *w = q->first;
+	if (w != NULL) {
+		q->first = w->next;
+		if (q->first == NULL)
+			q->last = NULL;
+	}
+	return w;
+}
+
+/**
+ * GCC doesn't see that the waiter is removed from the queue by the
+ * one who wakes it up, before the waiter's frame is gone.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdangling-pointer"
+#endif
+
+/** Suspend the current coroutine until it is woken via the queue. */
+static void
+coro_wait_queue_wait(struct coro_wait_queue *q)
+{
+	struct coro_waiter w;
+	w.coro = coro_this();
+	w.is_woken = false;
+	w.next = NULL;
+	if (q->last == NULL)
+		q->first = &w;
+	else
+		q->last->next = &w;
+	q->last = &w;
+	while (! w.is_woken)
+		coro_suspend();
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12
+#pragma GCC diagnostic pop
+#endif
+
+/** Wake up the first waiter. Returns false, if there are none. */
+static bool
+coro_wait_queue_wakeup_one(struct coro_wait_queue *q)
+{
+	struct coro_waiter *w = coro_wait_queue_pop(q);
+	if (w == NULL)
+		return false;
+	w->is_woken = true;
+	coro_wakeup(w->coro);
+	return true;
+}
+
+static void
+coro_wait_queue_wakeup_all(struct coro_wait_queue *q)
+{
+	while (coro_wait_queue_wakeup_one(q))
+		;
+}
+
+void
+coro_mutex_create(struct coro_mutex *m)
+{
+	m->is_locked = false;
+	coro_wait_queue_create(&m->waiters);
+}
+
+void
+coro_mutex_destroy(struct coro_mutex *m)
+{
+	assert(! m->is_locked);
+	assert(m->waiters.first == NULL);
+	(void)m;
+}
+
+void
+coro_mutex_lock(struct coro_mutex *m)
+{
+	if (! m->is_locked) {
+		m->is_locked = true;
+		return;
+	}
+	/* The unlocker passes the ownership right to the waiter. */
+	coro_wait_queue_wait(&m->waiters);
+	assert(m->is_locked);
+}
+
+bool
+coro_mutex_trylock(struct coro_mutex *m)
+{
+	if (m->is_locked)
+		return false;
+	m->is_locked = true;
+	return true;
+}
+
+void
+coro_mutex_unlock(struct coro_mutex *m)
+{
+	assert(m->is_locked);
+	if (! coro_wait_queue_wakeup_one(&m->waiters))
+		m->is_locked = false;
+}
+
+void
+coro_cond_create(struct coro_cond *c)
+{
+	coro_wait_queue_create(&c->waiters);
+}
+
+void
+coro_cond_destroy(struct coro_cond *c)
+{
+	assert(c->waiters.first == NULL);
+	(void)c;
+}
+
+void
+coro_cond_wait(struct coro_cond *c, struct coro_mutex *m)
+{
+	/*
+	 * Nobody can run between unlock and wait - the coroutines are
+	 * cooperative. So no signal can be lost.
+	 */
+	coro_mutex_unlock(m);
+	coro_wait_queue_wait(&c->waiters);
+	coro_mutex_lock(m);
+}
+
+void
+coro_cond_signal(struct coro_cond *c)
+{
+	coro_wait_queue_wakeup_one(&c->waiters);
+}
+
+void
+coro_cond_broadcast(struct coro_cond *c)
+{
+	coro_wait_queue_wakeup_all(&c->waiters);
+}
+
+void
+coro_wait_group_create(struct coro_wait_group *wg)
+{
+	wg->count = 0;
+	coro_wait_queue_create(&wg->waiters);
+}
+
+void
+coro_wait_group_destroy(struct coro_wait_group *wg)
+{
+	assert(wg->waiters.first == NULL);
+	(void)wg;
+}
+
+void
+coro_wait_group_add(struct coro_wait_group *wg, int count)
+{
+	wg->count += count;
+	assert(wg->count >= 0);
+}
+
+void
+coro_wait_group_done(struct coro_wait_group *wg)
+{
+	assert(wg->count > 0);
+	if (--wg->count == 0)
+		coro_wait_queue_wakeup_all(&wg->waiters);
+}
+
+void
+coro_wait_group_wait(struct coro_wait_group *wg)
+{
+	if (wg->count > 0)
+		coro_wait_queue_wait(&wg->waiters);
+}
+
+struct coro_channel {
+	/** Ring buffer of the messages. */
+	void **msgs;
+	int capacity;
+	/** Index of the oldest message. */
+	int head;
+	int count;
+	bool is_closed;
+	/** Producers waiting for a free slot. */
+	struct coro_wait_queue putters;
+	/** Consumers waiting for a message. */
+	struct coro_wait_queue getters;
+};
+
+struct coro_channel *
+coro_channel_new(int capacity)
+{
+	assert(capacity > 0);
+	struct coro_channel *ch = malloc(sizeof(*ch));
+	ch->msgs = malloc(capacity * sizeof(ch->msgs[0]));
+	ch->capacity = capacity;
+	ch->head = 0;
+	ch->count = 0;
+	ch->is_closed = false;
+	coro_wait_queue_create(&ch->putters);
+	coro_wait_queue_create(&ch->getters);
+	return ch;
+}
+
+void
+coro_channel_delete(struct coro_channel *ch)
+{
+	assert(ch->putters.first == NULL && ch->getters.first == NULL);
+	free(ch->msgs);
+	free(ch);
+}
+
+int
+coro_channel_put(struct coro_channel *ch, void *msg)
+{
+	/*
+	 * A woken up producer can find the channel full again if
+	 * another one was faster, hence the loop.
+	 */
+	while (! ch->is_closed && ch->count == ch->capacity)
+		coro_wait_queue_wait(&ch->putters);
+	if (ch->is_closed)
+		return -1;
+	ch->msgs[(ch->head + ch->count) % ch->capacity] = msg;
+	++ch->count;
+	coro_wait_queue_wakeup_one(&ch->getters);
+	return 0;
+}
+
+int
+coro_channel_get(struct coro_channel *ch, void **msg)
+{
+	while (! ch->is_closed && ch->count == 0)
+		coro_wait_queue_wait(&ch->getters);
+	if (ch->count == 0)
+		return -1;
+	*msg = ch->msgs[ch->head];
+	ch->head = (ch->head + 1) % ch->capacity;
+	--ch->count;
+	coro_wait_queue_wakeup_one(&ch->putters);
+	return 0;
+}
+
+void
+coro_channel_close(struct coro_channel *ch)
+{
+	ch->is_closed = true;
+	coro_wait_queue_wakeup_all(&ch->putters);
+	coro_wait_queue_wakeup_all(&ch->getters);
+}
+
+int
+coro_channel_count(const struct coro_channel *ch)
+{
+	return ch->count;
+}
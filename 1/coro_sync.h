@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Coroutine synchronization primitives. A coroutine waiting on
+ * any of them is suspended and does not take part in the
+ * scheduling until it is woken up, so waiting costs no switches.
+ * They work for the coroutines of one scheduler, not for the M:N
+ * one, and can't be waited on by the scheduler itself.
+ */
+
+struct coro_waiter;
+
+/** FIFO of coroutines waiting on a primitive. */
+struct coro_wait_queue {
+	struct coro_waiter *first;
+	struct coro_waiter *last;
+};
+
+/** Mutex. The ownership is passed to the waiters in FIFO order. */
+struct coro_mutex {
+	bool is_locked;
+	struct coro_wait_queue waiters;
+};
+
+void
+coro_mutex_create(struct coro_mutex *m);
+
+void
+coro_mutex_destroy(struct coro_mutex *m);
+
+void
+coro_mutex_lock(struct coro_mutex *m);
+
+/** Lock the mutex, if it is free. Returns true on success. */
+bool
+coro_mutex_trylock(struct coro_mutex *m);
+
+void
+coro_mutex_unlock(struct coro_mutex *m);
+
+/** Condition variable. */
+struct coro_cond {
+	struct coro_wait_queue waiters;
+};
+
+void
+coro_cond_create(struct coro_cond *c);
+
+void
+coro_cond_destroy(struct coro_cond *c);
+
+/**
+ * Unlock the mutex and wait for a signal. The mutex is locked
+ * again before return.
+ */
+void
+coro_cond_wait(struct coro_cond *c, struct coro_mutex *m);
+
+/** Wake up one waiter, if any. */
+void
+coro_cond_signal(struct coro_cond *c);
+
+/** Wake up all the waiters. */
+void
+coro_cond_broadcast(struct coro_cond *c);
+
+/**
+ * Wait group - a counter of unfinished jobs, which one can wait to
+ * drop to zero.
+ */
+struct coro_wait_group {
+	int count;
+	struct coro_wait_queue waiters;
+};
+
+void
+coro_wait_group_create(struct coro_wait_group *wg);
+
+void
+coro_wait_group_destroy(struct coro_wait_group *wg);
+
+/** Add @a count unfinished jobs. */
+void
+coro_wait_group_add(struct coro_wait_group *wg, int count);
+
+/** Mark one job finished. The waiters are woken up on zero. */
+void
+coro_wait_group_done(struct coro_wait_group *wg);
+
+/** Wait until all the jobs are finished. */
+void
+coro_wait_group_wait(struct coro_wait_group *wg);
+
+/**
+ * Bounded multi-producer multi-consumer channel of pointers.
+ * Producers wait while it is full, consumers wait while it is
+ * empty.
+ */
+struct coro_channel;
+
+/** Create a channel with room for @a capacity > 0 messages. */
+struct coro_channel *
+coro_channel_new(int capacity);
+
+/** Delete the channel. There should be no waiters. */
+void
+coro_channel_delete(struct coro_channel *ch);
+
+/**
+ * Put a message into the channel, waiting for a free slot if
+ * needed. Returns -1, if the channel is closed.
+ */
+int
+coro_channel_put(struct coro_channel *ch, void *msg);
+
+/**
+ * Get a message from the channel, waiting for one if needed.
+ * Returns -1, if the channel is closed and empty.
+ */
+int
+coro_channel_get(struct coro_channel *ch, void **msg);
+
+/**
+ * Close the channel. Nothing can be put into it anymore, the
+ * already put messages still can be taken. All the waiters are
+ * woken up.
+ */
+void
+coro_channel_close(struct coro_channel *ch);
+
+/** Number of messages in the channel. */
+int
+coro_channel_count(const struct coro_channel *ch);
@@ -0,0 +1,103 @@
+#include "int_parse.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+enum {
+	/** How many digits are taken at once. */
+	INT_PARSE_WIDTH = 8,
+};
+
+static const uint64_t int_parse_ones = 0x0101010101010101ULL;
+
+static inline bool
+int_parse_is_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool
+int_parse_is_digit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+/**
+ * Load 8 bytes as digit values. The non-digit bytes have the high
+ * bit set in the returned mask.
+ */
+static inline uint64_t
+int_parse_load(const char *pos, uint64_t *mask)
+{
+	uint64_t v;
+	memcpy(&v, pos, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	/* '0'..'9' become 0..9, everything else is 10 or more. */
+	v ^= 0x30 * int_parse_ones;
+	*mask = (((v & 0x7f * int_parse_ones) + 0x76 * int_parse_ones) | v) &
+		0x80 * int_parse_ones;
+	return v;
+}
+
+/**
+ * Convert 8 digit values, the most significant in the lowest byte,
+ * into a number. Each step combines the neighbour lanes - digits
+ * into 2-digit numbers, then into 4-digit ones, then the whole.
+ */
+static inline uint32_t
+int_parse_eight(uint64_t v)
+{
+	v = (v * 10 + (v >> 8)) & 0x00ff00ff00ff00ffULL;
+	v = (v * 100 + (v >> 16)) & 0x0000ffff0000ffffULL;
+	v = (v * 10000 + (v >> 32)) & 0xffffffffULL;
+	return v;
+}
+
+/** Parse the digits at @a pos, given that 8 bytes are readable. */
+static inline const char *
+int_parse_digits_fast(const char *pos, int64_t *res)
+{
+	uint64_t mask;
+	uint64_t v = int_parse_load(pos, &mask);
+	if (mask != 0) {
+		int len = __builtin_ctzll(mask) / 8;
+		if (len == 0)
+			return pos;
+		/* Shift the digits to the top, zeros come below. */
+		*res = int_parse_eight(v << (64 - len * 8));
+		return pos + len;
+	}
+	/* The rest digits of a longer number are added one by one. */
+	*res = int_parse_eight(v);
+	return pos + INT_PARSE_WIDTH;
+}
+
+size_t
+int_parse(const char **pos, const char *end, int *out, size_t count)
+{
+	const char *p = *pos;
+	size_t i = 0;
+	while (p < end && int_parse_is_space(*p))
+		++p;
+	while (i < count && p < end) {
+		bool is_neg = *p == '-';
+		const char *digits = p + is_neg;
+		int64_t value = 0;
+		const char *q = digits;
+		if (end - q >= INT_PARSE_WIDTH)
+			q = int_parse_digits_fast(q, &value);
+		while (q < end && int_parse_is_digit(*q))
+			value = value * 10 + (*q++ - '0');
+		if (q == digits || (q < end && ! int_parse_is_space(*q)))
+			break;
+		out[i++] = is_neg ? -value : value;
+		p = q;
+		while (p < end && int_parse_is_space(*p))
+			++p;
+	}
+	*pos = p;
+	return i;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Bulk parser of whitespace separated decimal integers, like the
+ * sort input files. It works on a buffer with the whole text and
+ * takes 8 digits at a time via SWAR - the byte lanes of a 64 bit
+ * integer. The numbers are parsed in batches, so a coroutine can
+ * yield between them.
+ */
+
+/**
+ * Parse not more than @a count integers from [*pos, end) into
+ * @a out. *pos is moved past the parsed numbers and the whitespace
+ * after them. Returns how many numbers are parsed. If it is less
+ * than @a count and *pos is not @a end, then *pos points at a token
+ * which is not a number. The numbers should fit into int.
+ */
+size_t
+int_parse(const char **pos, const char *end, int *out, size_t count);
+
+/**
+ * Upper bound of the number count in a text of @a size bytes. Each
+ * number but the last one takes at least 2 bytes with a separator.
+ */
+static inline size_t
+int_parse_max_count(size_t size)
+{
+	return size / 2 + 1;
+}
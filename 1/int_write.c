@@ -0,0 +1,122 @@
+#include "int_write.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void
+int_writer_create(struct int_writer *w, int fd)
+{
+	w->fd = fd;
+	w->buf = malloc(INT_WRITER_BUFFER_SIZE);
+	w->size = 0;
+	w->is_empty = true;
+}
+
+void
+int_writer_destroy(struct int_writer *w)
+{
+	free(w->buf);
+}
+
+int
+int_writer_flush(struct int_writer *w)
+{
+	const char *pos = w->buf;
+	while (w->size > 0) {
+		ssize_t rc = write(w->fd, pos, w->size);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		pos += rc;
+		w->size -= rc;
+	}
+	return 0;
+}
+
+/** Two digit strings "00".."99" back to back. */
+static const char int_writer_pairs[201] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+
+static const uint32_t int_writer_pow10[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+	1000000000,
+};
+
+/**
+ * Number of decimal digits. log10 is taken from log2 - the bit
+ * length times 1233 / 4096 ~ log10(2), and corrected by one
+ * comparison. v | 1 has the same digit count, and is not 0.
+ */
+static inline int
+int_writer_digit_count(uint32_t v)
+{
+	v |= 1;
+	int t = ((32 - __builtin_clz(v)) * 1233) >> 12;
+	return t + (v >= int_writer_pow10[t]);
+}
+
+/**
+ * Format a number at @a out, return its end. The length is known
+ * beforehand, so the digits are put right in place from the end,
+ * two at a time.
+ */
+static inline char *
+int_writer_format(char *out, int value)
+{
+	uint32_t v = value;
+	if (value < 0) {
+		*out++ = '-';
+		v = -v;
+	}
+	char *end = out + int_writer_digit_count(v);
+	char *p = end;
+	while (v >= 100) {
+		p -= 2;
+		memcpy(p, &int_writer_pairs[v % 100 * 2], 2);
+		v /= 100;
+	}
+	if (v >= 10) {
+		memcpy(p - 2, &int_writer_pairs[v * 2], 2);
+	} else {
+		p[-1] = '0' + v;
+	}
+	return end;
+}
+
+int
+int_writer_put(struct int_writer *w, const int *values, size_t count)
+{
+	while (count > 0) {
+		/* Check the room once for as many numbers as fit. */
+		size_t room = (INT_WRITER_BUFFER_SIZE - w->size) /
+			      INT_WRITER_MAX_LEN;
+		if (room == 0) {
+			if (int_writer_flush(w) != 0)
+				return -1;
+			continue;
+		}
+		size_t batch = count < room ? count : room;
+		char *out = w->buf + w->size;
+		size_t i = 0;
+		if (w->is_empty) {
+			out = int_writer_format(out, values[i++]);
+			w->is_empty = false;
+		}
+		for (; i < batch; ++i) {
+			*out++ = ' ';
+			out = int_writer_format(out, values[i]);
+		}
+		w->size = out - w->buf;
+		values += batch;
+		count -= batch;
+	}
+	return 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Buffered writer of ints as a space separated text. The numbers
+ * are formatted right into a big buffer, two digits at a time via
+ * a table, and the buffer is written out with write() when it is
+ * full.
+ */
+
+enum {
+	INT_WRITER_BUFFER_SIZE = 128 * 1024,
+	/** Maximal length of a formatted int with a separator. */
+	INT_WRITER_MAX_LEN = 12,
+};
+
+struct int_writer {
+	int fd;
+	char *buf;
+	size_t size;
+	/** True, if no numbers are written yet - no separator. */
+	bool is_empty;
+};
+
+void
+int_writer_create(struct int_writer *w, int fd);
+
+/** Free the buffer. It should be flushed before. */
+void
+int_writer_destroy(struct int_writer *w);
+
+/** Append numbers. Returns 0 on success, -1 on a write error. */
+int
+int_writer_put(struct int_writer *w, const int *values, size_t count);
+
+/** Write out the buffered text. Returns 0 or -1 on error. */
+int
+int_writer_flush(struct int_writer *w);
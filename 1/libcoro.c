@@ -1,78 +1,577 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <assert.h>
+#include <stdint.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Asynchronous file I/O is done via io_uring, if it is available,
+ * or by a helper thread otherwise. Build with -DCORO_IO_USE_URING=0
+ * to always use the helper thread.
+ */
+#ifndef CORO_IO_USE_URING
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CORO_IO_USE_URING 1
+#endif
+#endif
+#endif
+#ifndef CORO_IO_USE_URING
+#define CORO_IO_USE_URING 0
+#endif
+#if CORO_IO_USE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
 #include "libcoro.h"
 
 #define handle_error() ({printf("Error %s\n", strerror(errno)); exit(-1);})
 
+#if CORO_USE_SIGJMP
+
+/** Coroutine context is a jump buffer without the signal mask. */
+struct coro_ctx {
+	sigjmp_buf buf;
+};
+
+/**
+ * Remember the current context. Returns 0 right away and 1 when
+ * the context is switched to later.
+ */
+#define coro_ctx_save(ctx) sigsetjmp((ctx)->buf, 0)
+
+/** Remember the current context in @a from and jump to @a to. */
+static inline void
+coro_ctx_switch(struct coro_ctx *from, struct coro_ctx *to)
+{
+	if (sigsetjmp(from->buf, 0) == 0)
+		siglongjmp(to->buf, 1);
+}
+
+#else /* !CORO_USE_SIGJMP */
+
+/**
+ * Coroutine context is the callee-saved registers, the stack
+ * pointer and the address where to continue. The caller-saved
+ * registers don't need to be kept - the switch is a usual
+ * function call for the compiler, which spills them on its own.
+ * Signal mask is not touched at all, unlike in sigsetjmp().
+ */
+struct coro_ctx {
+#if defined(__x86_64__)
+	/** rbx, rbp, r12-r15, rsp, rip. */
+	void *regs[8];
+#elif defined(__aarch64__)
+	/** x19-x30, sp, d8-d15. */
+	void *regs[21];
+#else
+#error "Assembly context switch is not supported on this platform"
+#endif
+};
+
+/** Remember the current context in @a from and jump to @a to. */
+void
+coro_ctx_switch(struct coro_ctx *from, struct coro_ctx *to);
+
+#if defined(__APPLE__)
+#define CORO_ASM_FUNC(name)						\
+	"	.text\n"							\
+	"	.globl _" #name "\n"						\
+	"	.private_extern _" #name "\n"				\
+	"	.p2align 4\n"							\
+	"_" #name ":\n"
+#define CORO_ASM_END(name) ""
+#else
+#define CORO_ASM_FUNC(name)						\
+	"	.text\n"							\
+	"	.globl " #name "\n"						\
+	"	.hidden " #name "\n"						\
+	"	.type " #name ", %function\n"				\
+	"	.p2align 4\n"							\
+	#name ":\n"
+#define CORO_ASM_END(name) "	.size " #name ", .-" #name "\n"
+#endif
+
+#if defined(__x86_64__)
+
+#define CORO_ASM_SAVE_X86_64						\
+	"	movq %rbx, 0(%rdi)\n"						\
+	"	movq %rbp, 8(%rdi)\n"						\
+	"	movq %r12, 16(%rdi)\n"						\
+	"	movq %r13, 24(%rdi)\n"						\
+	"	movq %r14, 32(%rdi)\n"						\
+	"	movq %r15, 40(%rdi)\n"						\
+	/* The stack pointer as it will be after return. */		\
+	"	leaq 8(%rsp), %rdx\n"						\
+	"	movq %rdx, 48(%rdi)\n"						\
+	"	movq (%rsp), %rdx\n"						\
+	"	movq %rdx, 56(%rdi)\n"
+
+__asm__(
+CORO_ASM_FUNC(coro_ctx_switch)
+CORO_ASM_SAVE_X86_64
+"	movq 0(%rsi), %rbx\n"
+"	movq 8(%rsi), %rbp\n"
+"	movq 16(%rsi), %r12\n"
+"	movq 24(%rsi), %r13\n"
+"	movq 32(%rsi), %r14\n"
+"	movq 40(%rsi), %r15\n"
+"	movq 48(%rsi), %rsp\n"
+"	movl $1, %eax\n"
+"	jmpq *56(%rsi)\n"
+CORO_ASM_END(coro_ctx_switch)
+);
+
+#elif defined(__aarch64__)
+
+#define CORO_ASM_SAVE_AARCH64						\
+	"	stp x19, x20, [x0, #0]\n"					\
+	"	stp x21, x22, [x0, #16]\n"					\
+	"	stp x23, x24, [x0, #32]\n"					\
+	"	stp x25, x26, [x0, #48]\n"					\
+	"	stp x27, x28, [x0, #64]\n"					\
+	/* Frame pointer and the return address. */			\
+	"	stp x29, x30, [x0, #80]\n"					\
+	"	mov x2, sp\n"							\
+	"	str x2, [x0, #96]\n"						\
+	"	stp d8, d9, [x0, #104]\n"					\
+	"	stp d10, d11, [x0, #120]\n"					\
+	"	stp d12, d13, [x0, #136]\n"					\
+	"	stp d14, d15, [x0, #152]\n"
+
+__asm__(
+CORO_ASM_FUNC(coro_ctx_switch)
+CORO_ASM_SAVE_AARCH64
+"	ldp x19, x20, [x1, #0]\n"
+"	ldp x21, x22, [x1, #16]\n"
+"	ldp x23, x24, [x1, #32]\n"
+"	ldp x25, x26, [x1, #48]\n"
+"	ldp x27, x28, [x1, #64]\n"
+"	ldp x29, x30, [x1, #80]\n"
+"	ldr x2, [x1, #96]\n"
+"	mov sp, x2\n"
+"	ldp d8, d9, [x1, #104]\n"
+"	ldp d10, d11, [x1, #120]\n"
+"	ldp d12, d13, [x1, #136]\n"
+"	ldp d14, d15, [x1, #152]\n"
+"	mov x0, #1\n"
+"	ret\n"
+CORO_ASM_END(coro_ctx_switch)
+);
+
+#endif
+
+/**
+ * Prepare a context which on the first switch to it calls @a entry
+ * on the top of the given stack. The entry must never return.
+ */
+static void
+coro_ctx_make(struct coro_ctx *ctx, void *stack, size_t stack_size,
+	      void (*entry)(void))
+{
+	memset(ctx, 0, sizeof(*ctx));
+	uintptr_t top = ((uintptr_t)stack + stack_size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+	/*
+	 * Make it look like the entry was called - a null return
+	 * address is on top of the 16 byte aligned stack.
+	 */
+	top -= sizeof(void *);
+	*(void **)top = NULL;
+	ctx->regs[6] = (void *)top;
+	ctx->regs[7] = (void *)entry;
+#elif defined(__aarch64__)
+	ctx->regs[11] = (void *)entry;
+	ctx->regs[12] = (void *)top;
+#endif
+}
+
+#endif /* !CORO_USE_SIGJMP */
+
+/**
+ * Cheap monotonic time source for the time slices and the run time
+ * accounting - the CPU time stamp counter where it is available.
+ * Reading it costs a few cycles, unlike clock_gettime().
+ */
+static inline uint64_t
+coro_ticks(void)
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static double coro_ns_per_tick;
+static pthread_once_t coro_ticks_once = PTHREAD_ONCE_INIT;
+
+static long long
+coro_clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Find out how long one tick is. */
+static void
+coro_ticks_calibrate(void)
+{
+#if defined(__x86_64__)
+	/* TSC frequency is not reported anywhere reliably. */
+	long long start_ns = coro_clock_ns(), end_ns;
+	uint64_t start = coro_ticks();
+	while ((end_ns = coro_clock_ns()) - start_ns < 1000000)
+		;
+	coro_ns_per_tick = (double)(end_ns - start_ns) /
+			   (coro_ticks() - start);
+#elif defined(__aarch64__)
+	uint64_t freq;
+	__asm__ volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+	coro_ns_per_tick = 1000000000.0 / freq;
+#else
+	coro_ns_per_tick = 1;
+#endif
+}
+
 /** Main coroutine structure, its context. */
 struct coro {
 	/** A value, returned by func. */
 	int ret;
 	/** Stack, used by the coroutine. */
 	void *stack;
+	/** Usable stack size, without the guard page. */
+	size_t stack_size;
+	/**
+	 * Size of the accessible top part of the stack. Less than the
+	 * stack size for a small stack, which grows down on demand.
+	 */
+	size_t stack_committed;
 	/** An argument for the function func. */
 	void *func_arg;
 	/** A function to call as a coroutine. */
 	coro_f func;
 	/** Last remembered coroutine context. */
-	sigjmp_buf ctx;
+	struct coro_ctx ctx;
 	/** True, if the coroutine has finished. */
 	bool is_finished;
+	/** True, if the coroutine is suspended until a wakeup. */
+	bool is_blocked;
 	long long switch_count;
-	/** Links in the coroutine list, used by scheduler. */
+	/** Ticks spent running, not counting the current slice. */
+	uint64_t run_ticks;
+	/** When the coroutine was switched to the last time. */
+	uint64_t slice_start;
+	/** Identifier in the trace, given on the first traced switch. */
+	uint32_t trace_id;
+	/** When the coroutine became ready, if it is traced. */
+	uint64_t ready_ticks;
+	/** Scheduling delays, allocated on the first traced one. */
+	struct coro_delay_hist *delay_hist;
+	/**
+	 * Links in one of the scheduler queues - ready, blocked or
+	 * finished. A running coroutine is not in any of them.
+	 */
 	struct coro *next, *prev;
 };
 
+/** Intrusive FIFO queue of coroutines. */
+struct coro_queue {
+	struct coro *first;
+	struct coro *last;
+};
+
+static inline void
+coro_queue_push(struct coro_queue *q, struct coro *c)
+{
+	c->next = NULL;
+	c->prev = q->last;
+	if (q->last != NULL)
+		q->last->next = c;
+	else
+		q->first = c;
+	q->last = c;
+}
+
+static inline void
+coro_queue_remove(struct coro_queue *q, struct coro *c)
+{
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		q->first = c->next;
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+	else
+		q->last = c->prev;
+	c->next = NULL;
+	c->prev = NULL;
+}
+
+static inline struct coro *
+coro_queue_pop(struct coro_queue *q)
+{
+	struct coro *c = q->first;
+	if (c != NULL)
+		coro_queue_remove(q, c);
+	return c;
+}
+
 /**
- * Scheduler is a main coroutine - it catches and returns dead
- * ones to a user.
- */
-static struct coro coro_sched;
-/**
- * True, if in that moment the scheduler is waiting for a
- * coroutine finish.
+ * Pool of the coroutine stacks. Each stack is a separate mapping
+ * with a PROT_NONE guard page below it, so an overflow crashes
+ * right away instead of silently corrupting the neighbour memory.
+ * Freed stacks are cached and reused in LIFO order - the last freed
+ * stack is the most likely to be still in the CPU cache.
+ *
+ * A small stack is mapped with MAP_NORESERVE, and only its top is
+ * accessible. The rest is PROT_NONE like the guard page, but a
+ * fault there makes the stack grow instead of crashing.
  */
-static bool is_sched_waiting = false;
-/** Which coroutine works at this moment. */
-static struct coro *coro_this_ptr = NULL;
-/** List of all the coroutines. */
-static struct coro *coro_list = NULL;
+struct coro_stack_pool {
+	/** Usable size of each new stack. */
+	size_t stack_size;
+	/** Initial accessible size of the small stacks, 0 if off. */
+	size_t small_size;
+	/** Maximal number of cached free stacks. */
+	int cache_max;
+	/** Number of cached free stacks. */
+	int cache_count;
+	/**
+	 * Top of the free stacks list. Each free stack keeps the
+	 * link to the next one in its topmost word.
+	 */
+	void *cache_top;
+	/** Statistics. */
+	struct coro_stack_stat stat;
+};
+
+static size_t
+coro_page_size(void)
+{
+	static size_t page_size = 0;
+	if (page_size == 0)
+		page_size = sysconf(_SC_PAGESIZE);
+	return page_size;
+}
+
+/** Address of the free list link of a cached stack. */
+static inline void **
+coro_stack_link(void *stack, size_t stack_size)
+{
+	return (void **)((char *)stack + stack_size) - 1;
+}
+
+/** How much of a new stack is accessible right away. */
+static inline size_t
+coro_stack_pool_committed(const struct coro_stack_pool *pool)
+{
+	if (pool->small_size == 0 || pool->small_size > pool->stack_size)
+		return pool->stack_size;
+	return pool->small_size;
+}
+
+static void *
+coro_stack_map(size_t stack_size, size_t committed)
+{
+	size_t page_size = coro_page_size();
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_STACK
+	flags |= MAP_STACK;
+#endif
+	if (committed == stack_size) {
+		char *base = mmap(NULL, stack_size + page_size,
+				  PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (base == MAP_FAILED)
+			handle_error();
+		if (mprotect(base, page_size, PROT_NONE) != 0)
+			handle_error();
+		return base + page_size;
+	}
+	char *base = mmap(NULL, stack_size + page_size, PROT_NONE,
+			  flags | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED)
+		handle_error();
+	char *top = base + page_size + stack_size;
+	if (mprotect(top - committed, committed,
+		     PROT_READ | PROT_WRITE) != 0)
+		handle_error();
+	return base + page_size;
+}
+
+static void
+coro_stack_unmap(void *stack, size_t stack_size)
+{
+	size_t page_size = coro_page_size();
+	if (munmap((char *)stack - page_size, stack_size + page_size) != 0)
+		handle_error();
+}
+
+static void *
+coro_stack_pool_get(struct coro_stack_pool *pool)
+{
+	struct coro_stack_stat *stat = &pool->stat;
+	void *stack = pool->cache_top;
+	if (stack != NULL) {
+		pool->cache_top = *coro_stack_link(stack, pool->stack_size);
+		--pool->cache_count;
+		--stat->cached;
+		++stat->hits;
+		return stack;
+	}
+	++stat->misses;
+	if (++stat->resident > stat->peak_resident)
+		stat->peak_resident = stat->resident;
+	return coro_stack_map(pool->stack_size,
+			      coro_stack_pool_committed(pool));
+}
+
 /**
- * Buffer, used by the coroutine constructor to escape from the
- * signal handler back into the constructor to rollback
- * sigaltstack etc.
+ * Return a stack to the pool. @a committed is how much of it is
+ * accessible now, @a used is its high-water mark. A small stack
+ * is shrunk back, and all the pages under the top one are dropped.
+ * So the next owner starts from scratch and its high-water mark
+ * is its own.
  */
-static sigjmp_buf start_point;
-
-/** Add a new coroutine to the beginning of the list. */
 static void
-coro_list_add(struct coro *c)
+coro_stack_pool_put(struct coro_stack_pool *pool, void *stack,
+		    size_t stack_size, size_t committed, size_t used)
 {
-	c->next = coro_list;
-	c->prev = NULL;
-	if (coro_list != NULL)
-		coro_list->prev = c;
-	coro_list = c;
+	if (stack_size != pool->stack_size ||
+	    pool->cache_count >= pool->cache_max) {
+		coro_stack_unmap(stack, stack_size);
+		--pool->stat.resident;
+		return;
+	}
+	char *top = (char *)stack + stack_size;
+	size_t page_size = coro_page_size();
+	size_t initial = coro_stack_pool_committed(pool);
+	if (initial < stack_size && used > page_size &&
+	    madvise(top - used, used - page_size, MADV_DONTNEED) != 0)
+		handle_error();
+	if (committed > initial) {
+		if (mprotect(top - committed, committed - initial,
+			     PROT_NONE) != 0)
+			handle_error();
+	} else if (committed < initial) {
+		if (mprotect(top - initial, initial - committed,
+			     PROT_READ | PROT_WRITE) != 0)
+			handle_error();
+	}
+	*coro_stack_link(stack, stack_size) = pool->cache_top;
+	pool->cache_top = stack;
+	++pool->cache_count;
+	++pool->stat.cached;
 }
 
-/** Remove a coroutine from the list. */
+/** Unmap cached stacks until not more than @a count are left. */
 static void
-coro_list_delete(struct coro *c)
+coro_stack_pool_trim(struct coro_stack_pool *pool, int count)
 {
-	struct coro *prev = c->prev, *next = c->next;
-	if (prev != NULL)
-		prev->next = next;
-	if (next != NULL)
-		next->prev = prev;
-	if (prev == NULL)
-		coro_list = next;
+	while (pool->cache_count > count) {
+		void *stack = pool->cache_top;
+		pool->cache_top = *coro_stack_link(stack, pool->stack_size);
+		--pool->cache_count;
+		--pool->stat.cached;
+		coro_stack_unmap(stack, pool->stack_size);
+		--pool->stat.resident;
+	}
 }
 
+/**
+ * Scheduler is a main coroutine - it catches and returns dead
+ * ones to a user. Each coroutine is in exactly one of its queues,
+ * so both switching to a next coroutine and picking a finished one
+ * are O(1) regardless of how many coroutines are there.
+ */
+struct coro_sched {
+	/** Context of the scheduler itself. */
+	struct coro main;
+	/**
+	 * True, if in that moment the scheduler is waiting for a
+	 * coroutine finish.
+	 */
+	bool is_waiting;
+	/** Which coroutine works at this moment. */
+	struct coro *this_ptr;
+	/**
+	 * Which coroutine is being switched from. Its stack is still
+	 * in use for a few instructions after this_ptr is changed.
+	 * The main coroutine resets it, because the one switched from
+	 * can be deleted then.
+	 */
+	struct coro *switch_from;
+	/** Alternate signal stack for growing the small stacks. */
+	void *signal_stack;
+	/** Identifier of the thread in the trace, 0 if not given. */
+	uint32_t trace_thread;
+	/** Time slice of each coroutine in ticks. */
+	uint64_t quantum_ticks;
+	/** Coroutines ready to run, in the order of running. */
+	struct coro_queue ready;
+	/** Coroutines waiting for a wakeup. */
+	struct coro_queue blocked;
+	/** Finished coroutines not yet returned to the user. */
+	struct coro_queue finished;
+	/** Stacks of the coroutines. */
+	struct coro_stack_pool stack_pool;
+	/**
+	 * Worker of an M:N scheduler, if this scheduler is run by
+	 * one. Then the ready coroutines are kept by the worker.
+	 */
+	struct coro_worker *worker;
+	/** File I/O executor, created on the first coro_read/write. */
+	struct coro_io *io;
+};
+
+/**
+ * Each thread has its own scheduler. With the M:N scheduler a
+ * coroutine can continue on another thread after a switch. So the
+ * code running on a coroutine stack must not use a scheduler
+ * pointer obtained before a switch - the compiler is free to cache
+ * the thread local address in a register.
+ */
+static __thread struct coro_sched sched;
+
+static bool
+coro_io_has_requests(const struct coro_io *io);
+
+static void
+coro_io_poll(struct coro_io *io);
+
+static void
+coro_io_wait(struct coro_io *io);
+
+static void
+coro_io_delete(struct coro_io *io);
+#if CORO_USE_SIGJMP
+/**
+ * Buffer, used by the coroutine constructor to escape from the
+ * signal handler back into the constructor to rollback
+ * sigaltstack etc.
+ */
+static sigjmp_buf start_point;
+#endif
+
 int
 coro_status(const struct coro *c)
 {
@@ -85,61 +584,623 @@ coro_switch_count(const struct coro *c)
 	return c->switch_count;
 }
 
+long long
+coro_run_time(const struct coro *c)
+{
+	uint64_t ticks = c->run_ticks;
+	if (c == sched.this_ptr)
+		ticks += coro_ticks() - c->slice_start;
+	return ticks * coro_ns_per_tick;
+}
+
 bool
 coro_is_finished(const struct coro *c)
 {
 	return c->is_finished;
 }
 
+size_t
+coro_stack_used(const struct coro *c)
+{
+	size_t page_size = coro_page_size();
+	char *top = (char *)c->stack + c->stack_size;
+	char *page = top - c->stack_committed;
+	/* Find the lowest resident page, a chunk at a time. */
+	unsigned char vec[256];
+	while (page < top) {
+		size_t count = (top - page) / page_size;
+		if (count > sizeof(vec))
+			count = sizeof(vec);
+		if (mincore(page, count * page_size, vec) != 0)
+			handle_error();
+		for (size_t i = 0; i < count; ++i) {
+			if ((vec[i] & 1) != 0)
+				return top - page - i * page_size;
+		}
+		page += count * page_size;
+	}
+	return 0;
+}
+
 void
 coro_delete(struct coro *c)
 {
-	free(c->stack);
+	struct coro_stack_pool *pool = &sched.stack_pool;
+	/*
+	 * Scanning a whole usual stack would cost more than creating
+	 * a coroutine. The small ones are scanned anyway to be shrunk.
+	 */
+	size_t used = 0;
+	if (pool->small_size != 0) {
+		used = coro_stack_used(c);
+		++pool->stat.deleted;
+		pool->stat.used_total += used;
+		if ((long long)used > pool->stat.used_max)
+			pool->stat.used_max = used;
+	}
+	coro_stack_pool_put(pool, c->stack, c->stack_size,
+			    c->stack_committed, used);
+	free(c->delay_hist);
 	free(c);
 }
 
+/** A switch, recorded in the trace ring. */
+struct coro_trace_event {
+	/**
+	 * Position of the event in the trace plus 1, 0 while it is
+	 * being written. Tells whether the slot has been overwritten.
+	 */
+	uint64_t seq;
+	uint64_t ticks;
+	uint32_t thread;
+	uint32_t from;
+	uint32_t to;
+};
+
+/**
+ * Ring of the last switches. The writers take positions with an
+ * atomic increment and mark each slot with a sequence number, like
+ * a seqlock, so the reader skips the slots being overwritten.
+ */
+struct coro_trace {
+	/** Position of the next event. */
+	uint64_t head;
+	/** Capacity minus 1, the capacity is a power of 2. */
+	uint64_t mask;
+	/** Time of the start. */
+	uint64_t start_ticks;
+	struct coro_trace_event *events;
+};
+
+/** The trace being recorded, NULL if tracing is off. */
+static struct coro_trace *coro_trace_active;
+/** The last started trace, kept for the export. */
+static struct coro_trace *coro_trace_last;
+/** Last given identifiers of the coroutines and the threads. */
+static uint32_t coro_trace_last_id;
+static uint32_t coro_trace_last_thread;
+
+static inline struct coro_trace *
+coro_trace_get(void)
+{
+	return __atomic_load_n(&coro_trace_active, __ATOMIC_RELAXED);
+}
+
+/** Remember when the coroutine became ready, if tracing. */
+static inline void
+coro_trace_ready(struct coro *c)
+{
+	if (coro_trace_get() != NULL)
+		c->ready_ticks = coro_ticks();
+}
+
+static uint32_t
+coro_trace_id(struct coro *c)
+{
+	/* The scheduler is 0 in each thread. */
+	if (c->trace_id == 0 && c != &sched.main) {
+		c->trace_id = __atomic_add_fetch(&coro_trace_last_id, 1,
+						 __ATOMIC_RELAXED);
+	}
+	return c->trace_id;
+}
+
+static void
+coro_delay_hist_add(struct coro *c, uint64_t ticks)
+{
+	struct coro_delay_hist *hist = c->delay_hist;
+	if (hist == NULL) {
+		hist = calloc(1, sizeof(*hist));
+		if (hist == NULL)
+			return;
+		c->delay_hist = hist;
+	}
+	long long delay = ticks * coro_ns_per_tick;
+	int i = delay == 0 ? 0 : 64 - __builtin_clzll(delay);
+	if (i >= CORO_DELAY_HIST_SIZE)
+		i = CORO_DELAY_HIST_SIZE - 1;
+	++hist->count[i];
+	++hist->total;
+	hist->sum += delay;
+	if (delay > hist->max)
+		hist->max = delay;
+}
+
+/** Record the switch and the scheduling delay of @a to. */
+static void __attribute__((noinline))
+coro_trace_switch(struct coro_trace *trace, struct coro *from,
+		  struct coro *to, uint64_t now)
+{
+	/* Could become ready during a previous trace. */
+	if (to->ready_ticks >= trace->start_ticks) {
+		if (now > to->ready_ticks)
+			coro_delay_hist_add(to, now - to->ready_ticks);
+		else
+			coro_delay_hist_add(to, 0);
+		to->ready_ticks = 0;
+	}
+	if (sched.trace_thread == 0) {
+		sched.trace_thread = __atomic_add_fetch(
+			&coro_trace_last_thread, 1, __ATOMIC_RELAXED);
+	}
+	uint64_t pos = __atomic_fetch_add(&trace->head, 1,
+					  __ATOMIC_RELAXED);
+	struct coro_trace_event *e = &trace->events[pos & trace->mask];
+	__atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&e->ticks, now, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->thread, sched.trace_thread, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->from, coro_trace_id(from), __ATOMIC_RELAXED);
+	__atomic_store_n(&e->to, coro_trace_id(to), __ATOMIC_RELAXED);
+	__atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/** Read the event at @a pos. Returns false, if overwritten. */
+static bool
+coro_trace_read(const struct coro_trace *trace, uint64_t pos,
+		struct coro_trace_event *res)
+{
+	const struct coro_trace_event *e = &trace->events[pos & trace->mask];
+	uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+	res->ticks = __atomic_load_n(&e->ticks, __ATOMIC_RELAXED);
+	res->thread = __atomic_load_n(&e->thread, __ATOMIC_RELAXED);
+	res->from = __atomic_load_n(&e->from, __ATOMIC_RELAXED);
+	res->to = __atomic_load_n(&e->to, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return seq == pos + 1 &&
+	       __atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq;
+}
+
+void
+coro_trace_start(size_t capacity)
+{
+	pthread_once(&coro_ticks_once, coro_ticks_calibrate);
+	size_t size = 1;
+	while (size < capacity)
+		size *= 2;
+	struct coro_trace *trace = malloc(sizeof(*trace));
+	trace->events = calloc(size, sizeof(trace->events[0]));
+	if (trace->events == NULL)
+		handle_error();
+	trace->head = 0;
+	trace->mask = size - 1;
+	trace->start_ticks = coro_ticks();
+	coro_trace_stop();
+	if (coro_trace_last != NULL) {
+		free(coro_trace_last->events);
+		free(coro_trace_last);
+	}
+	coro_trace_last = trace;
+	__atomic_store_n(&coro_trace_active, trace, __ATOMIC_RELEASE);
+}
+
+void
+coro_trace_stop(void)
+{
+	__atomic_store_n(&coro_trace_active, NULL, __ATOMIC_RELEASE);
+}
+
+int
+coro_trace_export(const char *path)
+{
+	const struct coro_trace *trace = coro_trace_last;
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		return -1;
+	fprintf(f, "{\"traceEvents\":[\n");
+	bool is_first = true;
+	if (trace != NULL) {
+		uint32_t thread_count = __atomic_load_n(
+			&coro_trace_last_thread, __ATOMIC_RELAXED);
+		/* The last switch of each thread, its slice is open. */
+		struct coro_trace_event *last =
+			calloc(thread_count + 1, sizeof(last[0]));
+		uint64_t head = __atomic_load_n(&trace->head,
+						__ATOMIC_ACQUIRE);
+		uint64_t pos = 0;
+		if (head > trace->mask + 1)
+			pos = head - trace->mask - 1;
+		for (; pos < head; ++pos) {
+			struct coro_trace_event e;
+			if (! coro_trace_read(trace, pos, &e) ||
+			    e.thread > thread_count)
+				continue;
+			struct coro_trace_event *prev = &last[e.thread];
+			if (prev->seq != 0 && e.ticks >= prev->ticks) {
+				double ts = (prev->ticks - trace->start_ticks) *
+					    coro_ns_per_tick / 1000;
+				double dur = (e.ticks - prev->ticks) *
+					     coro_ns_per_tick / 1000;
+				fprintf(f, "%s{\"name\":\"%s %u\",\"ph\":\"X\","
+					"\"ts\":%.3f,\"dur\":%.3f,"
+					"\"pid\":%u,\"tid\":%u}",
+					is_first ? "" : ",\n",
+					prev->to == 0 ? "sched" : "coro",
+					prev->to, ts, dur, e.thread, prev->to);
+				is_first = false;
+			}
+			*prev = e;
+			prev->seq = 1;
+		}
+		for (uint32_t i = 1; i <= thread_count; ++i) {
+			if (last[i].seq == 0)
+				continue;
+			fprintf(f, "%s{\"name\":\"process_name\",\"ph\":\"M\","
+				"\"pid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+				is_first ? "" : ",\n", i, i);
+			is_first = false;
+		}
+		free(last);
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	if (ferror(f) != 0) {
+		fclose(f);
+		return -1;
+	}
+	return fclose(f);
+}
+
+void
+coro_delay_hist(const struct coro *c, struct coro_delay_hist *hist)
+{
+	if (c->delay_hist != NULL)
+		*hist = *c->delay_hist;
+	else
+		memset(hist, 0, sizeof(*hist));
+}
+
+long long
+coro_delay_hist_percentile(const struct coro_delay_hist *hist,
+			   double percent)
+{
+	long long need = hist->total * percent / 100;
+	long long sum = 0;
+	for (int i = 0; i < CORO_DELAY_HIST_SIZE; ++i) {
+		sum += hist->count[i];
+		if (sum < need || sum == 0)
+			continue;
+		if (i == 0)
+			return 0;
+		if (i == CORO_DELAY_HIST_SIZE - 1 || (1LL << i) > hist->max)
+			break;
+		return 1LL << i;
+	}
+	return hist->max;
+}
+
 /** Switch the current coroutine to an arbitrary one. */
 static void
 coro_yield_to(struct coro *to)
 {
-	struct coro *from = coro_this_ptr;
+	struct coro *from = sched.this_ptr;
 	++from->switch_count;
-	if (sigsetjmp(from->ctx, 0) == 0)
-		siglongjmp(to->ctx, 1);
-	coro_this_ptr = from;
+	uint64_t now = coro_ticks();
+	from->run_ticks += now - from->slice_start;
+	to->slice_start = now;
+	struct coro_trace *trace = coro_trace_get();
+	if (__builtin_expect(trace != NULL, 0))
+		coro_trace_switch(trace, from, to, now);
+	/*
+	 * The one who switches sets the current coroutine. Also a just
+	 * created coroutine finds itself via this pointer.
+	 */
+	sched.this_ptr = to;
+	sched.switch_from = from;
+	coro_ctx_switch(&from->ctx, &to->ctx);
+}
+
+/**
+ * Switch to a next ready coroutine, or to the scheduler if there
+ * are none. The current coroutine should be already put into a
+ * queue, if it is going to continue.
+ */
+static void
+coro_yield_next(void)
+{
+	struct coro *to = coro_queue_pop(&sched.ready);
+	if (to == NULL) {
+		/* Can not return - nobody would wake the scheduler up. */
+		if (! sched.is_waiting) {
+			printf("Critical error - no place to return!\n");
+			exit(-1);
+		}
+		to = &sched.main;
+	}
+	coro_yield_to(to);
 }
 
 void
 coro_yield(void)
 {
-	struct coro *from = coro_this_ptr;
-	struct coro *to = from->next;
-	if (to == NULL)
-		coro_yield_to(&coro_sched);
-	else
-		coro_yield_to(to);
+	struct coro *from = sched.this_ptr;
+	/* The scheduler only runs coroutines in coro_sched_wait(). */
+	if (from == &sched.main)
+		return;
+	/*
+	 * A worker puts the coroutine back into a queue only after
+	 * the switch. Otherwise another worker could steal and run it
+	 * before its context is saved.
+	 */
+	if (sched.worker != NULL) {
+		coro_yield_to(&sched.main);
+		return;
+	}
+	/* Wake up the coroutines whose I/O is done, if any. */
+	if (coro_io_has_requests(sched.io))
+		coro_io_poll(sched.io);
+	if (sched.ready.first == NULL) {
+		/* Nobody to switch to - just start a new slice. */
+		uint64_t now = coro_ticks();
+		from->run_ticks += now - from->slice_start;
+		from->slice_start = now;
+		return;
+	}
+	coro_trace_ready(from);
+	coro_queue_push(&sched.ready, from);
+	coro_yield_next();
+}
+
+bool
+coro_yield_if_quantum_expired(void)
+{
+	struct coro *c = sched.this_ptr;
+	if (coro_ticks() - c->slice_start < sched.quantum_ticks)
+		return false;
+	coro_yield();
+	return true;
+}
+
+void
+coro_suspend(void)
+{
+	struct coro *c = sched.this_ptr;
+	assert(c != &sched.main);
+	/* M:N scheduler runs only the coroutines which never block. */
+	assert(sched.worker == NULL);
+	c->is_blocked = true;
+	coro_queue_push(&sched.blocked, c);
+	coro_yield_next();
+}
+
+void
+coro_wakeup(struct coro *c)
+{
+	if (! c->is_blocked)
+		return;
+	c->is_blocked = false;
+	coro_queue_remove(&sched.blocked, c);
+	coro_trace_ready(c);
+	coro_queue_push(&sched.ready, c);
+}
+
+enum {
+	/** Size of the alternate signal stack of each thread. */
+	CORO_SIGNAL_STACK_SIZE = 64 * 1024,
+};
+
+/** SIGSEGV handler, which was set before the small stacks. */
+static struct sigaction coro_stack_old_action;
+static pthread_once_t coro_stack_fault_once = PTHREAD_ONCE_INIT;
+/** True, if the small stacks were turned on in any thread. */
+static bool coro_stack_fault_is_set;
+
+/**
+ * Grow the stack of @a c down to the faulting address, if it is
+ * in the inaccessible part of the stack. Returns false otherwise.
+ */
+static bool
+coro_stack_grow(struct coro *c, char *addr)
+{
+	if (c == NULL || c->stack_committed == c->stack_size)
+		return false;
+	char *top = (char *)c->stack + c->stack_size;
+	if (addr < (char *)c->stack || addr >= top - c->stack_committed)
+		return false;
+	size_t page_size = coro_page_size();
+	size_t size = c->stack_committed * 2;
+	size_t need = top - (char *)((uintptr_t)addr & ~(page_size - 1));
+	if (size < need)
+		size = need;
+	if (size > c->stack_size)
+		size = c->stack_size;
+	if (mprotect(top - size, size - c->stack_committed,
+		     PROT_READ | PROT_WRITE) != 0)
+		return false;
+	c->stack_committed = size;
+	return true;
+}
+
+/**
+ * The handler runs on the alternate stack, because the faulting
+ * one has no space left. Besides the current coroutine, the one
+ * being switched from is checked - the switch itself still uses
+ * its stack.
+ */
+static void
+coro_stack_fault_handler(int signo, siginfo_t *info, void *context)
+{
+	if (coro_stack_grow(sched.this_ptr, info->si_addr) ||
+	    coro_stack_grow(sched.switch_from, info->si_addr))
+		return;
+	/* Not a small stack fault - let the previous handler crash. */
+	struct sigaction *old = &coro_stack_old_action;
+	if ((old->sa_flags & SA_SIGINFO) != 0) {
+		old->sa_sigaction(signo, info, context);
+	} else if (old->sa_handler != SIG_DFL &&
+		   old->sa_handler != SIG_IGN) {
+		old->sa_handler(signo);
+	} else {
+		/* Return to the fault, which is fatal now. */
+		signal(SIGSEGV, SIG_DFL);
+	}
+}
+
+static void
+coro_stack_fault_set(void)
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = coro_stack_fault_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGSEGV, &sa, &coro_stack_old_action) != 0)
+		handle_error();
+	__atomic_store_n(&coro_stack_fault_is_set, true, __ATOMIC_RELEASE);
+}
+
+/** Give the current thread an alternate signal stack. */
+static void
+coro_signal_stack_create(void)
+{
+	if (sched.signal_stack != NULL)
+		return;
+	sched.signal_stack = coro_stack_map(CORO_SIGNAL_STACK_SIZE,
+					    CORO_SIGNAL_STACK_SIZE);
+	stack_t st;
+	st.ss_sp = sched.signal_stack;
+	st.ss_size = CORO_SIGNAL_STACK_SIZE;
+	st.ss_flags = 0;
+	if (sigaltstack(&st, NULL) != 0)
+		handle_error();
+}
+
+static void
+coro_signal_stack_delete(void)
+{
+	if (sched.signal_stack == NULL)
+		return;
+	stack_t st;
+	memset(&st, 0, sizeof(st));
+	st.ss_flags = SS_DISABLE;
+	if (sigaltstack(&st, NULL) != 0)
+		handle_error();
+	coro_stack_unmap(sched.signal_stack, CORO_SIGNAL_STACK_SIZE);
+	sched.signal_stack = NULL;
 }
 
 void
 coro_sched_init(void)
 {
-	memset(&coro_sched, 0, sizeof(coro_sched));
-	coro_this_ptr = &coro_sched;
+	memset(&sched, 0, sizeof(sched));
+	sched.this_ptr = &sched.main;
+	pthread_once(&coro_ticks_once, coro_ticks_calibrate);
+	sched.main.slice_start = coro_ticks();
+	sched.stack_pool.stack_size = CORO_STACK_SIZE_DEFAULT;
+	sched.stack_pool.cache_max = CORO_STACK_CACHE_DEFAULT;
+	/* The small stacks of other threads can migrate here. */
+	if (__atomic_load_n(&coro_stack_fault_is_set, __ATOMIC_ACQUIRE))
+		coro_signal_stack_create();
+}
+
+void
+coro_sched_set_quantum(long long quantum)
+{
+	pthread_once(&coro_ticks_once, coro_ticks_calibrate);
+	sched.quantum_ticks = quantum / coro_ns_per_tick;
+}
+
+void
+coro_sched_set_stack_size(size_t size)
+{
+	struct coro_stack_pool *pool = &sched.stack_pool;
+	size_t page_size = coro_page_size();
+	if (size < SIGSTKSZ)
+		size = SIGSTKSZ;
+	size = (size + page_size - 1) & ~(page_size - 1);
+	if (size == pool->stack_size)
+		return;
+	coro_stack_pool_trim(pool, 0);
+	pool->stack_size = size;
+}
+
+void
+coro_sched_set_stack_small_size(size_t size)
+{
+	struct coro_stack_pool *pool = &sched.stack_pool;
+	size_t page_size = coro_page_size();
+	if (size != 0 && size < SIGSTKSZ)
+		size = SIGSTKSZ;
+	size = (size + page_size - 1) & ~(page_size - 1);
+	if (size == pool->small_size)
+		return;
+	coro_stack_pool_trim(pool, 0);
+	pool->small_size = size;
+	if (size == 0)
+		return;
+	pthread_once(&coro_stack_fault_once, coro_stack_fault_set);
+	coro_signal_stack_create();
+}
+
+void
+coro_sched_set_stack_cache_size(int count)
+{
+	sched.stack_pool.cache_max = count;
+	coro_stack_pool_trim(&sched.stack_pool, count);
+}
+
+void
+coro_sched_stack_stat(struct coro_stack_stat *stat)
+{
+	*stat = sched.stack_pool.stat;
+}
+
+void
+coro_sched_destroy(void)
+{
+	coro_stack_pool_trim(&sched.stack_pool, 0);
+	if (sched.io != NULL) {
+		coro_io_delete(sched.io);
+		sched.io = NULL;
+	}
+	coro_signal_stack_delete();
 }
 
 struct coro *
 coro_sched_wait(void)
 {
-	while (coro_list != NULL) {
-		for (struct coro *c = coro_list; c != NULL; c = c->next) {
-			if (c->is_finished) {
-				coro_list_delete(c);
-				return c;
-			}
+	while (true) {
+		struct coro *c = coro_queue_pop(&sched.finished);
+		if (c != NULL)
+			return c;
+		if (coro_io_has_requests(sched.io))
+			coro_io_poll(sched.io);
+		c = coro_queue_pop(&sched.ready);
+		if (c == NULL) {
+			if (! coro_io_has_requests(sched.io))
+				break;
+			/* All the coroutines wait for I/O. */
+			coro_io_wait(sched.io);
+			continue;
 		}
-		is_sched_waiting = true;
-		coro_yield_to(coro_list);
-		is_sched_waiting = false;
+		sched.is_waiting = true;
+		coro_yield_to(c);
+		sched.is_waiting = false;
+		/* It can be deleted now. */
+		sched.switch_from = NULL;
+	}
+	if (sched.blocked.first != NULL) {
+		printf("Critical error - all coroutines are blocked!\n");
+		exit(-1);
 	}
 	return NULL;
 }
@@ -147,9 +1208,95 @@ coro_sched_wait(void)
 struct coro *
 coro_this(void)
 {
-	return coro_this_ptr;
+	return sched.this_ptr;
+}
+
+/**
+ * Give the finished coroutine to the scheduler. It is a separate
+ * function so as the scheduler of the current thread is looked up
+ * anew - the coroutine could migrate to another thread while
+ * running.
+ */
+static void __attribute__((noinline))
+coro_body_finish(struct coro *c)
+{
+	c->is_finished = true;
+	/* A worker puts the coroutine into the finished queue itself. */
+	if (sched.worker == NULL) {
+		coro_queue_push(&sched.finished, c);
+		/* Can not return - 'ret' address is invalid already! */
+		if (! sched.is_waiting) {
+			printf("Critical error - no place to return!\n");
+			exit(-1);
+		}
+	}
+	coro_yield_to(&sched.main);
+}
+
+/**
+ * Run the coroutine function and give the result to the
+ * scheduler. The coroutine never returns from here.
+ */
+static void
+coro_body_run(struct coro *c)
+{
+	c->ret = c->func(c->func_arg);
+	coro_body_finish(c);
+}
+
+/**
+ * Allocate a coroutine object and take a stack for it from the
+ * pool. The context is not initialized.
+ */
+static struct coro *
+coro_alloc(coro_f func, void *func_arg)
+{
+	struct coro *c = (struct coro *) malloc(sizeof(*c));
+	c->ret = 0;
+	c->stack = coro_stack_pool_get(&sched.stack_pool);
+	c->stack_size = sched.stack_pool.stack_size;
+	c->stack_committed = coro_stack_pool_committed(&sched.stack_pool);
+	c->func = func;
+	c->func_arg = func_arg;
+	c->is_finished = false;
+	c->is_blocked = false;
+	c->switch_count = 0;
+	c->run_ticks = 0;
+	c->slice_start = 0;
+	c->trace_id = 0;
+	c->ready_ticks = 0;
+	c->delay_hist = NULL;
+	return c;
+}
+
+#if ! CORO_USE_SIGJMP
+
+/**
+ * The first function called on a new coroutine stack. The
+ * switching code has already set the current coroutine to the new
+ * coroutine.
+ */
+static void
+coro_entry(void)
+{
+	coro_body_run(sched.this_ptr);
+}
+
+/**
+ * Create a coroutine without any signals or syscalls - its stack
+ * is prepared so the first switch to it lands in coro_entry().
+ * No process-wide signal state is touched either.
+ */
+static struct coro *
+coro_create(coro_f func, void *func_arg)
+{
+	struct coro *c = coro_alloc(func, func_arg);
+	coro_ctx_make(&c->ctx, c->stack, c->stack_size, coro_entry);
+	return c;
 }
 
+#else /* CORO_USE_SIGJMP */
+
 /**
  * The core part of the coroutines creation - this signal handler
  * is run on a separate stack using sigaltstack. On an invokation
@@ -160,42 +1307,26 @@ static void
 coro_body(int signum)
 {
 	(void)signum;
-	struct coro *c = coro_this_ptr;
-	coro_this_ptr = NULL;
+	struct coro *c = sched.this_ptr;
+	sched.this_ptr = NULL;
 	/*
 	 * On an invokation jump back to the constructor right
 	 * after remembering the context.
 	 */
-	if (sigsetjmp(c->ctx, 0) == 0)
+	if (coro_ctx_save(&c->ctx) == 0)
 		siglongjmp(start_point, 1);
 	/*
 	 * If the execution is here, then the coroutine should
 	 * finaly start work.
 	 */
-	coro_this_ptr = c;
-	c->ret = c->func(c->func_arg);
-	c->is_finished = true;
-	/* Can not return - 'ret' address is invalid already! */
-	if (! is_sched_waiting) {
-		printf("Critical error - no place to return!\n");
-		exit(-1);
-	}
-	siglongjmp(coro_sched.ctx, 1);
+	sched.this_ptr = c;
+	coro_body_run(c);
 }
 
-struct coro *
-coro_new(coro_f func, void *func_arg)
+static struct coro *
+coro_create(coro_f func, void *func_arg)
 {
-	struct coro *c = (struct coro *) malloc(sizeof(*c));
-	c->ret = 0;
-	int stack_size = 1024 * 1024;
-	if (stack_size < SIGSTKSZ)
-		stack_size = SIGSTKSZ;
-	c->stack = malloc(stack_size);
-	c->func = func;
-	c->func_arg = func_arg;
-	c->is_finished = false;
-	c->switch_count = 0;
+	struct coro *c = coro_alloc(func, func_arg);
 	/*
 	 * SIGUSR2 is used. First of all, block new signals to be
 	 * able to set a new handler.
@@ -219,20 +1350,20 @@ coro_new(coro_f func, void *func_arg)
 	/* Create that new stack. */
 	stack_t oldst, newst;
 	newst.ss_sp = c->stack;
-	newst.ss_size = stack_size;
+	newst.ss_size = c->stack_size;
 	newst.ss_flags = 0;
 	if (sigaltstack(&newst, &oldst) != 0)
 		handle_error();
 	/* Jump onto the stack and remember its position. */
-	struct coro *old_this = coro_this_ptr;
-	coro_this_ptr = c;
+	struct coro *old_this = sched.this_ptr;
+	sched.this_ptr = c;
 	sigemptyset(&suss);
 	if (sigsetjmp(start_point, 1) == 0) {
 		raise(SIGUSR2);
-		while (coro_this_ptr != NULL)
+		while (sched.this_ptr != NULL)
 			sigsuspend(&suss);
 	}
-	coro_this_ptr = old_this;
+	sched.this_ptr = old_this;
 	/*
 	 * Return the old stack, unblock SIGUSR2. In other words,
 	 * rollback all global changes. The newly created stack
@@ -251,8 +1382,662 @@ coro_new(coro_f func, void *func_arg)
 		handle_error();
 	if (sigprocmask(SIG_SETMASK, &olds, NULL) != 0)
 		handle_error();
+	return c;
+}
 
+#endif /* CORO_USE_SIGJMP */
+
+struct coro *
+coro_new(coro_f func, void *func_arg)
+{
+	struct coro *c = coro_create(func, func_arg);
 	/* Now scheduler can work with that coroutine. */
-	coro_list_add(c);
+	coro_trace_ready(c);
+	coro_queue_push(&sched.ready, c);
 	return c;
 }
+
+/**
+ * M:N scheduler. Each worker thread runs its own scheduler and
+ * keeps its own queue of ready coroutines. Every switch goes
+ * through the worker loop, which puts a yielded coroutine back
+ * into the queue. A worker with an empty queue steals coroutines
+ * from the others, so a runnable coroutine migrates to an idle
+ * core.
+ */
+struct coro_worker {
+	/** M:N scheduler the worker belongs to. */
+	struct coro_mt_sched *mt;
+	pthread_t thread;
+	/** Protects the ready queue from the thieves. */
+	pthread_mutex_t lock;
+	/** Coroutines ready to run on this worker. */
+	struct coro_queue ready;
+	/** How many coroutines were stolen from the other workers. */
+	long long steal_count;
+};
+
+struct coro_mt_sched {
+	struct coro_worker *workers;
+	int worker_count;
+	/** Worker which gets a next new coroutine. */
+	int next_worker;
+	/** Ready coroutines in all the worker queues. */
+	int ready_count;
+	/** Workers sleeping due to no ready coroutines. */
+	int idle_count;
+	/** Protects the members below. */
+	pthread_mutex_t lock;
+	/** Idle workers wait here for ready coroutines. */
+	pthread_cond_t work_cond;
+	/** The user waits here for finished coroutines. */
+	pthread_cond_t finish_cond;
+	/** Finished coroutines not yet returned to the user. */
+	struct coro_queue finished;
+	/** Coroutines not yet returned to the user. */
+	int coro_count;
+	/** True, if the workers should exit. */
+	bool is_stopped;
+	/** Time slice of the coroutines, same for all workers. */
+	uint64_t quantum_ticks;
+};
+
+/** Put a ready coroutine into a worker's queue. */
+static void
+coro_worker_push(struct coro_worker *w, struct coro *c)
+{
+	struct coro_mt_sched *mt = w->mt;
+	coro_trace_ready(c);
+	pthread_mutex_lock(&w->lock);
+	coro_queue_push(&w->ready, c);
+	pthread_mutex_unlock(&w->lock);
+	/*
+	 * The counters are sequentially consistent - either the
+	 * pusher sees a worker going to sleep, or the worker sees the
+	 * new coroutine. So no wakeup is lost.
+	 */
+	__atomic_add_fetch(&mt->ready_count, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&mt->idle_count, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&mt->lock);
+		pthread_cond_signal(&mt->work_cond);
+		pthread_mutex_unlock(&mt->lock);
+	}
+}
+
+/** Take a coroutine from the head of own queue. */
+static struct coro *
+coro_worker_pop(struct coro_worker *w)
+{
+	pthread_mutex_lock(&w->lock);
+	struct coro *c = coro_queue_pop(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+	if (c != NULL)
+		__atomic_sub_fetch(&w->mt->ready_count, 1, __ATOMIC_SEQ_CST);
+	return c;
+}
+
+/**
+ * Take a coroutine from the tail of another worker's queue. The
+ * head is left to the owner, it is going to run soon anyway.
+ */
+static struct coro *
+coro_worker_steal(struct coro_worker *w)
+{
+	struct coro_mt_sched *mt = w->mt;
+	int self = w - mt->workers;
+	for (int i = 1; i < mt->worker_count; ++i) {
+		struct coro_worker *victim =
+			&mt->workers[(self + i) % mt->worker_count];
+		/* Just a hint to not lock the empty queues. */
+		if (__atomic_load_n(&victim->ready.first,
+				    __ATOMIC_RELAXED) == NULL)
+			continue;
+		pthread_mutex_lock(&victim->lock);
+		struct coro *c = victim->ready.last;
+		if (c != NULL)
+			coro_queue_remove(&victim->ready, c);
+		pthread_mutex_unlock(&victim->lock);
+		if (c != NULL) {
+			__atomic_sub_fetch(&mt->ready_count, 1,
+					   __ATOMIC_SEQ_CST);
+			__atomic_add_fetch(&w->steal_count, 1,
+					   __ATOMIC_RELAXED);
+			return c;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Sleep until there are ready coroutines. Returns false if the
+ * scheduler is stopped.
+ */
+static bool
+coro_worker_wait_work(struct coro_worker *w)
+{
+	struct coro_mt_sched *mt = w->mt;
+	pthread_mutex_lock(&mt->lock);
+	__atomic_add_fetch(&mt->idle_count, 1, __ATOMIC_SEQ_CST);
+	while (! mt->is_stopped &&
+	       __atomic_load_n(&mt->ready_count, __ATOMIC_SEQ_CST) == 0)
+		pthread_cond_wait(&mt->work_cond, &mt->lock);
+	__atomic_sub_fetch(&mt->idle_count, 1, __ATOMIC_SEQ_CST);
+	bool is_stopped = mt->is_stopped;
+	pthread_mutex_unlock(&mt->lock);
+	return ! is_stopped;
+}
+
+static void *
+coro_worker_f(void *arg)
+{
+	struct coro_worker *w = arg;
+	struct coro_mt_sched *mt = w->mt;
+	coro_sched_init();
+	sched.worker = w;
+	sched.quantum_ticks = mt->quantum_ticks;
+	while (true) {
+		struct coro *c = coro_worker_pop(w);
+		if (c == NULL)
+			c = coro_worker_steal(w);
+		if (c == NULL) {
+			if (! coro_worker_wait_work(w))
+				break;
+			continue;
+		}
+		coro_yield_to(c);
+		sched.switch_from = NULL;
+		if (! c->is_finished) {
+			coro_worker_push(w, c);
+			continue;
+		}
+		pthread_mutex_lock(&mt->lock);
+		coro_queue_push(&mt->finished, c);
+		pthread_cond_signal(&mt->finish_cond);
+		pthread_mutex_unlock(&mt->lock);
+	}
+	coro_sched_destroy();
+	return NULL;
+}
+
+struct coro_mt_sched *
+coro_mt_sched_new(int thread_count)
+{
+	assert(thread_count > 0);
+	struct coro_mt_sched *mt = calloc(1, sizeof(*mt));
+	mt->worker_count = thread_count;
+	mt->quantum_ticks = sched.quantum_ticks;
+	mt->workers = calloc(thread_count, sizeof(mt->workers[0]));
+	pthread_mutex_init(&mt->lock, NULL);
+	pthread_cond_init(&mt->work_cond, NULL);
+	pthread_cond_init(&mt->finish_cond, NULL);
+	for (int i = 0; i < thread_count; ++i) {
+		struct coro_worker *w = &mt->workers[i];
+		w->mt = mt;
+		pthread_mutex_init(&w->lock, NULL);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		struct coro_worker *w = &mt->workers[i];
+		if (pthread_create(&w->thread, NULL, coro_worker_f, w) != 0)
+			handle_error();
+	}
+	return mt;
+}
+
+struct coro *
+coro_mt_new(struct coro_mt_sched *mt, coro_f func, void *func_arg)
+{
+	struct coro *c = coro_create(func, func_arg);
+	pthread_mutex_lock(&mt->lock);
+	++mt->coro_count;
+	struct coro_worker *w = &mt->workers[mt->next_worker];
+	mt->next_worker = (mt->next_worker + 1) % mt->worker_count;
+	pthread_mutex_unlock(&mt->lock);
+	coro_worker_push(w, c);
+	return c;
+}
+
+struct coro *
+coro_mt_wait(struct coro_mt_sched *mt)
+{
+	pthread_mutex_lock(&mt->lock);
+	struct coro *c = NULL;
+	if (mt->coro_count > 0) {
+		while (mt->finished.first == NULL)
+			pthread_cond_wait(&mt->finish_cond, &mt->lock);
+		c = coro_queue_pop(&mt->finished);
+		--mt->coro_count;
+	}
+	pthread_mutex_unlock(&mt->lock);
+	return c;
+}
+
+long long
+coro_mt_sched_steal_count(const struct coro_mt_sched *mt)
+{
+	long long count = 0;
+	for (int i = 0; i < mt->worker_count; ++i)
+		count += __atomic_load_n(&mt->workers[i].steal_count,
+					 __ATOMIC_RELAXED);
+	return count;
+}
+
+void
+coro_mt_sched_delete(struct coro_mt_sched *mt)
+{
+	pthread_mutex_lock(&mt->lock);
+	assert(mt->coro_count == 0);
+	mt->is_stopped = true;
+	pthread_cond_broadcast(&mt->work_cond);
+	pthread_mutex_unlock(&mt->lock);
+	for (int i = 0; i < mt->worker_count; ++i) {
+		struct coro_worker *w = &mt->workers[i];
+		pthread_join(w->thread, NULL);
+		pthread_mutex_destroy(&w->lock);
+	}
+	pthread_cond_destroy(&mt->finish_cond);
+	pthread_cond_destroy(&mt->work_cond);
+	pthread_mutex_destroy(&mt->lock);
+	free(mt->workers);
+	free(mt);
+}
+
+/**
+ * Asynchronous file I/O. A coroutine doing I/O is suspended until
+ * the request is done by io_uring or by the helper thread, while
+ * the other coroutines continue working. The completions are
+ * collected on each yield and when the scheduler has nothing else
+ * to do.
+ */
+enum coro_io_op {
+	CORO_IO_READ,
+	CORO_IO_WRITE,
+};
+
+struct coro_io_req {
+	enum coro_io_op op;
+	int fd;
+	void *buf;
+	size_t size;
+	/** Result of read() or write(). */
+	ssize_t result;
+	/** Errno, if the result is -1. */
+	int error;
+	bool is_done;
+	/** The coroutine waiting for the request. */
+	struct coro *coro;
+	/** Link in the helper thread queues. */
+	struct coro_io_req *next;
+};
+
+#if CORO_IO_USE_URING
+
+/** Mapped io_uring queues. */
+struct coro_uring {
+	int fd;
+	unsigned entries;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+};
+
+enum {
+	CORO_URING_ENTRIES = 256,
+};
+
+#endif /* CORO_IO_USE_URING */
+
+struct coro_io {
+	/** Requests submitted and not yet completed. */
+	int inflight;
+#if CORO_IO_USE_URING
+	/** True, if io_uring is used instead of the thread. */
+	bool is_uring;
+	struct coro_uring ring;
+#endif
+	/** Helper thread, executes the requests one by one. */
+	pthread_t thread;
+	/** Protects the request lists. */
+	pthread_mutex_t lock;
+	/** The thread waits here for new requests. */
+	pthread_cond_t req_cond;
+	/** The scheduler waits here for the completions. */
+	pthread_cond_t done_cond;
+	/** Requests waiting for the thread, FIFO. */
+	struct coro_io_req *req_first;
+	struct coro_io_req *req_last;
+	/** Done requests not yet given back to the coroutines. */
+	struct coro_io_req *done;
+	/** Count of the done requests, read without the lock. */
+	int done_count;
+	/** True, if the thread should exit. */
+	bool is_stopped;
+};
+
+static ssize_t
+coro_io_req_exec(struct coro_io_req *req)
+{
+	if (req->op == CORO_IO_READ)
+		return read(req->fd, req->buf, req->size);
+	return write(req->fd, req->buf, req->size);
+}
+
+/** Give the request result back to its coroutine. */
+static void
+coro_io_req_complete(struct coro_io *io, struct coro_io_req *req)
+{
+	req->is_done = true;
+	--io->inflight;
+	coro_wakeup(req->coro);
+}
+
+#if CORO_IO_USE_URING
+
+static int
+coro_uring_setup(struct coro_uring *ring)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = syscall(__NR_io_uring_setup, CORO_URING_ENTRIES, &params);
+	if (fd < 0)
+		return -1;
+	/* Reads and writes at the current file position are needed. */
+	if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+		close(fd);
+		return -1;
+	}
+	ring->fd = fd;
+	ring->entries = params.sq_entries;
+	ring->sq_size = params.sq_off.array +
+			params.sq_entries * sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes +
+			params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		goto error_close;
+	ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (ring->cq_ptr == MAP_FAILED)
+		goto error_unmap_sq;
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto error_unmap_cq;
+	char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 0;
+
+error_unmap_cq:
+	munmap(ring->cq_ptr, ring->cq_size);
+error_unmap_sq:
+	munmap(ring->sq_ptr, ring->sq_size);
+error_close:
+	close(fd);
+	return -1;
+}
+
+static void
+coro_uring_destroy(struct coro_uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->cq_ptr, ring->cq_size);
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+}
+
+static int
+coro_uring_enter(struct coro_uring *ring, unsigned to_submit,
+		 unsigned min_complete, unsigned flags)
+{
+	int rc;
+	do {
+		rc = syscall(__NR_io_uring_enter, ring->fd, to_submit,
+			     min_complete, flags, NULL, 0);
+	} while (rc < 0 && errno == EINTR);
+	return rc;
+}
+
+/** Put the request into the ring and make the kernel start it. */
+static void
+coro_uring_submit(struct coro_uring *ring, struct coro_io_req *req)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = req->op == CORO_IO_READ ? IORING_OP_READ :
+						IORING_OP_WRITE;
+	sqe->fd = req->fd;
+	sqe->addr = (uintptr_t)req->buf;
+	sqe->len = req->size;
+	/* -1 means the current file position, like read() does. */
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = (uintptr_t)req;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	if (coro_uring_enter(ring, 1, 0, 0) < 0)
+		handle_error();
+}
+
+static void
+coro_uring_poll(struct coro_io *io)
+{
+	struct coro_uring *ring = &io->ring;
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		struct coro_io_req *req = (void *)(uintptr_t)cqe->user_data;
+		if (cqe->res < 0) {
+			req->result = -1;
+			req->error = -cqe->res;
+		} else {
+			req->result = cqe->res;
+		}
+		coro_io_req_complete(io, req);
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#endif /* CORO_IO_USE_URING */
+
+static void *
+coro_io_thread_f(void *arg)
+{
+	struct coro_io *io = arg;
+	pthread_mutex_lock(&io->lock);
+	while (true) {
+		while (! io->is_stopped && io->req_first == NULL)
+			pthread_cond_wait(&io->req_cond, &io->lock);
+		if (io->is_stopped)
+			break;
+		struct coro_io_req *req = io->req_first;
+		io->req_first = req->next;
+		if (io->req_first == NULL)
+			io->req_last = NULL;
+		pthread_mutex_unlock(&io->lock);
+
+		req->result = coro_io_req_exec(req);
+		req->error = errno;
+
+		pthread_mutex_lock(&io->lock);
+		req->next = io->done;
+		io->done = req;
+		__atomic_add_fetch(&io->done_count, 1, __ATOMIC_RELEASE);
+		pthread_cond_signal(&io->done_cond);
+	}
+	pthread_mutex_unlock(&io->lock);
+	return NULL;
+}
+
+static struct coro_io *
+coro_io_new(void)
+{
+	struct coro_io *io = calloc(1, sizeof(*io));
+#if CORO_IO_USE_URING
+	if (coro_uring_setup(&io->ring) == 0) {
+		io->is_uring = true;
+		return io;
+	}
+#endif
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->req_cond, NULL);
+	pthread_cond_init(&io->done_cond, NULL);
+	if (pthread_create(&io->thread, NULL, coro_io_thread_f, io) != 0)
+		handle_error();
+	return io;
+}
+
+static void
+coro_io_delete(struct coro_io *io)
+{
+	assert(io->inflight == 0);
+#if CORO_IO_USE_URING
+	if (io->is_uring) {
+		coro_uring_destroy(&io->ring);
+		free(io);
+		return;
+	}
+#endif
+	pthread_mutex_lock(&io->lock);
+	io->is_stopped = true;
+	pthread_cond_signal(&io->req_cond);
+	pthread_mutex_unlock(&io->lock);
+	pthread_join(io->thread, NULL);
+	pthread_cond_destroy(&io->done_cond);
+	pthread_cond_destroy(&io->req_cond);
+	pthread_mutex_destroy(&io->lock);
+	free(io);
+}
+
+static bool
+coro_io_has_requests(const struct coro_io *io)
+{
+	return io != NULL && io->inflight > 0;
+}
+
+static void
+coro_io_submit(struct coro_io *io, struct coro_io_req *req)
+{
+	++io->inflight;
+#if CORO_IO_USE_URING
+	if (io->is_uring) {
+		coro_uring_submit(&io->ring, req);
+		return;
+	}
+#endif
+	req->next = NULL;
+	pthread_mutex_lock(&io->lock);
+	if (io->req_last == NULL)
+		io->req_first = req;
+	else
+		io->req_last->next = req;
+	io->req_last = req;
+	pthread_cond_signal(&io->req_cond);
+	pthread_mutex_unlock(&io->lock);
+}
+
+/** Wake up the coroutines whose requests are done. Doesn't block. */
+static void
+coro_io_poll(struct coro_io *io)
+{
+#if CORO_IO_USE_URING
+	if (io->is_uring) {
+		coro_uring_poll(io);
+		return;
+	}
+#endif
+	if (__atomic_load_n(&io->done_count, __ATOMIC_ACQUIRE) == 0)
+		return;
+	pthread_mutex_lock(&io->lock);
+	struct coro_io_req *req = io->done;
+	io->done = NULL;
+	io->done_count = 0;
+	pthread_mutex_unlock(&io->lock);
+	while (req != NULL) {
+		struct coro_io_req *next = req->next;
+		coro_io_req_complete(io, req);
+		req = next;
+	}
+}
+
+/** Block until at least one request is done. */
+static void
+coro_io_wait(struct coro_io *io)
+{
+#if CORO_IO_USE_URING
+	if (io->is_uring) {
+		if (coro_uring_enter(&io->ring, 0, 1,
+				     IORING_ENTER_GETEVENTS) < 0)
+			handle_error();
+		coro_uring_poll(io);
+		return;
+	}
+#endif
+	pthread_mutex_lock(&io->lock);
+	while (io->done == NULL)
+		pthread_cond_wait(&io->done_cond, &io->lock);
+	pthread_mutex_unlock(&io->lock);
+	coro_io_poll(io);
+}
+
+static ssize_t
+coro_io_exec(enum coro_io_op op, int fd, void *buf, size_t size)
+{
+	struct coro_io_req req;
+	req.op = op;
+	req.fd = fd;
+	req.buf = buf;
+	req.size = size;
+	req.is_done = false;
+	req.coro = sched.this_ptr;
+	/*
+	 * The scheduler itself can't be suspended, neither can the
+	 * coroutines of an M:N scheduler. They just block.
+	 */
+	if (req.coro == &sched.main || sched.worker != NULL)
+		return coro_io_req_exec(&req);
+	if (sched.io == NULL)
+		sched.io = coro_io_new();
+#if CORO_IO_USE_URING
+	/* The ring is full - can't wait for a free slot here. */
+	struct coro_io *io = sched.io;
+	if (io->is_uring && io->inflight >= (int)io->ring.entries)
+		return coro_io_req_exec(&req);
+#endif
+	coro_io_submit(sched.io, &req);
+	while (! req.is_done)
+		coro_suspend();
+	if (req.result < 0)
+		errno = req.error;
+	return req.result;
+}
+
+ssize_t
+coro_read(int fd, void *buf, size_t count)
+{
+	return coro_io_exec(CORO_IO_READ, fd, buf, count);
+}
+
+ssize_t
+coro_write(int fd, const void *buf, size_t count)
+{
+	return coro_io_exec(CORO_IO_WRITE, fd, (void *)buf, count);
+}
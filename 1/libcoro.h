@@ -1,14 +1,129 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Context switch backend. By default the coroutines are switched
+ * by a few assembly instructions which save only the callee-saved
+ * registers and the stack pointer. That is available on x86-64
+ * and aarch64. Build with -DCORO_USE_SIGJMP=1 to use the portable
+ * sigsetjmp()/siglongjmp() switch instead.
+ */
+#ifndef CORO_USE_SIGJMP
+#if defined(__x86_64__) || defined(__aarch64__)
+#define CORO_USE_SIGJMP 0
+#else
+#define CORO_USE_SIGJMP 1
+#endif
+#endif
 
 struct coro;
+struct coro_mt_sched;
 typedef int (*coro_f)(void *);
 
+enum {
+	/** Usable stack size of a coroutine by default. */
+	CORO_STACK_SIZE_DEFAULT = 1024 * 1024,
+	/** How many freed stacks are kept for reuse by default. */
+	CORO_STACK_CACHE_DEFAULT = 64,
+	/** A good initial size of the small stacks. */
+	CORO_STACK_SMALL_SIZE = 16 * 1024,
+	/** Number of buckets in a scheduling delay histogram. */
+	CORO_DELAY_HIST_SIZE = 32,
+};
+
+/** Statistics of the scheduler's coroutine stack pool. */
+struct coro_stack_stat {
+	/** Stacks taken from the cache of freed ones. */
+	long long hits;
+	/** Stacks which had to be mapped anew. */
+	long long misses;
+	/** Stacks mapped at the moment, both used and cached. */
+	long long resident;
+	/** Maximal number of stacks mapped at the same time. */
+	long long peak_resident;
+	/** Freed stacks waiting for reuse. */
+	long long cached;
+	/** Deleted coroutines with small stacks, counted below. */
+	long long deleted;
+	/** Sum of the stack high-water marks of deleted coroutines. */
+	long long used_total;
+	/** Maximal stack high-water mark of a deleted coroutine. */
+	long long used_max;
+};
+
+/**
+ * Scheduling delays of a coroutine - how long it waited for its
+ * turn after becoming ready to run. Collected while tracing is on.
+ */
+struct coro_delay_hist {
+	/**
+	 * Number of delays of each length. count[0] - shorter than
+	 * 1 ns, count[i] - from 2^(i - 1) to 2^i ns. The last bucket
+	 * also gets all the longer delays.
+	 */
+	long long count[CORO_DELAY_HIST_SIZE];
+	/** Number of delays. */
+	long long total;
+	/** Sum of the delays in nanoseconds. */
+	long long sum;
+	/** The longest delay in nanoseconds. */
+	long long max;
+};
+
 /** Make current context scheduler. */
 void
 coro_sched_init(void);
 
+/**
+ * Release the resources kept by the scheduler, such as the cached
+ * coroutine stacks. All the coroutines should be deleted already.
+ */
+void
+coro_sched_destroy(void);
+
+/**
+ * Set the stack size for new coroutines. It is rounded up to the
+ * page size. The already cached stacks are unmapped if the size
+ * changes.
+ */
+void
+coro_sched_set_stack_size(size_t size);
+
+/**
+ * Make the new coroutine stacks small. Only the top @a size bytes
+ * are accessible at first, the rest of the stack size is just
+ * reserved. When a coroutine touches the reserved part, the stack
+ * grows down, at least twice. And it is shrunk back when the
+ * coroutine is deleted. So the resident memory follows the actual
+ * usage, and lots of mostly idle coroutines are cheap. 0 turns
+ * the small stacks off, that is the default.
+ *
+ * The growth is done by a SIGSEGV handler running on an alternate
+ * signal stack of each thread running the coroutines. The other
+ * faults are passed to the handler set before.
+ */
+void
+coro_sched_set_stack_small_size(size_t size);
+
+/** Set how many freed stacks can be cached for reuse. */
+void
+coro_sched_set_stack_cache_size(int count);
+
+/**
+ * Set the time slice of each coroutine in nanoseconds, used by
+ * coro_yield_if_quantum_expired(). 0 by default - always yield.
+ * M:N schedulers take the quantum of the thread creating them.
+ */
+void
+coro_sched_set_quantum(long long quantum);
+
+/** Get statistics of the coroutine stack pool. */
+void
+coro_sched_stack_stat(struct coro_stack_stat *stat);
+
 /**
  * Block until any coroutine has finished. It is returned. NULl,
  * if no coroutines.
@@ -34,6 +149,40 @@ coro_status(const struct coro *c);
 long long
 coro_switch_count(const struct coro *c);
 
+/**
+ * How long the coroutine has been running, in nanoseconds. The
+ * time while it was waiting for its turn is not included.
+ */
+long long
+coro_run_time(const struct coro *c);
+
+/**
+ * High-water mark of the coroutine stack in bytes, with the page
+ * granularity. The small stacks are cleaned before reuse, so the
+ * mark is exact. A usual stack taken from the cache can also
+ * count the pages touched by its previous owners. The marks of
+ * the small stacks are summed up into the stack statistics by
+ * coro_delete().
+ */
+size_t
+coro_stack_used(const struct coro *c);
+
+/**
+ * Get the scheduling delay histogram of the coroutine. It is empty,
+ * if the coroutine was never switched to while tracing.
+ */
+void
+coro_delay_hist(const struct coro *c, struct coro_delay_hist *hist);
+
+/**
+ * Upper bound of the delay in nanoseconds, which is not exceeded
+ * by @a percent of the delays in the histogram. It is precise up
+ * to the bucket - a power of 2.
+ */
+long long
+coro_delay_hist_percentile(const struct coro_delay_hist *hist,
+			   double percent);
+
 /** Check if the coroutine has finished. */
 bool
 coro_is_finished(const struct coro *c);
@@ -45,3 +194,105 @@ coro_delete(struct coro *c);
 /** Switch to another not finished coroutine. */
 void
 coro_yield(void);
+
+/**
+ * Yield, if the current coroutine has used up its time slice set
+ * by coro_sched_set_quantum(). Checking the time is just a few
+ * cycles, so it can be called on each iteration of a hot loop.
+ * Returns true, if yielded.
+ */
+bool
+coro_yield_if_quantum_expired(void);
+
+/**
+ * Remove the current coroutine from the scheduling until somebody
+ * calls coro_wakeup() on it.
+ */
+void
+coro_suspend(void);
+
+/**
+ * Make a suspended coroutine ready to run again. Does nothing, if
+ * the coroutine is not suspended.
+ */
+void
+coro_wakeup(struct coro *c);
+
+/**
+ * Same as read(), but only the calling coroutine waits for the
+ * result. The others continue working while the data is read by
+ * io_uring or by a helper thread. Called not from a coroutine, or
+ * from an M:N scheduler coroutine, it is just a blocking read().
+ */
+ssize_t
+coro_read(int fd, void *buf, size_t count);
+
+/** Same as coro_read(), but for write(). */
+ssize_t
+coro_write(int fd, const void *buf, size_t count);
+
+/**
+ * Tracing. Each switch in any thread is recorded into a shared
+ * lock-free ring - when, which thread, from which coroutine and to
+ * which one. Also the scheduling delay histograms are collected.
+ * When tracing is off, a switch only checks that it is off.
+ */
+
+/**
+ * Start tracing into a new ring, able to keep @a capacity last
+ * switches. The previous trace is dropped, so no thread should be
+ * switching coroutines while it is started.
+ */
+void
+coro_trace_start(size_t capacity);
+
+/** Stop tracing. The trace is kept for the export. */
+void
+coro_trace_stop(void);
+
+/**
+ * Save the last trace into the file in Chrome trace-event JSON
+ * format, viewable in chrome://tracing and Perfetto. Each thread
+ * is a process there, each coroutine running in it is a thread,
+ * and 0 is the scheduler itself. Returns 0 on success, -1 on error
+ * with errno set.
+ */
+int
+coro_trace_export(const char *path);
+
+/**
+ * M:N scheduler API. The coroutines are run by several worker
+ * threads, each having its own scheduler. A worker without ready
+ * coroutines steals them from the others, so the coroutines
+ * migrate to idle cores. The coroutines are created and reaped by
+ * one thread, the stacks are taken from its scheduler - it should
+ * call coro_sched_init() first. The coroutines can only yield,
+ * they can not be suspended. And they should not rely on being
+ * run by the same thread all the time.
+ */
+
+/** Create an M:N scheduler with @a thread_count workers. */
+struct coro_mt_sched *
+coro_mt_sched_new(int thread_count);
+
+/**
+ * Stop the workers and free the scheduler. All its coroutines
+ * should be returned by coro_mt_wait() already.
+ */
+void
+coro_mt_sched_delete(struct coro_mt_sched *mt);
+
+/** Create a new coroutine and give it to one of the workers. */
+struct coro *
+coro_mt_new(struct coro_mt_sched *mt, coro_f func, void *func_arg);
+
+/**
+ * Block until any coroutine of the M:N scheduler has finished. It
+ * is returned. NULL, if no coroutines.
+ */
+struct coro *
+coro_mt_wait(struct coro_mt_sched *mt);
+
+/** How many times the workers stole coroutines from each other. */
+long long
+coro_mt_sched_steal_count(const struct coro_mt_sched *mt);
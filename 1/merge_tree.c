@@ -0,0 +1,86 @@
+#include "merge_tree.h"
+
+#include <stdlib.h>
+
+static inline int64_t
+merge_run_key(struct merge_run *run)
+{
+	if (run->pos < run->end)
+		return *run->pos;
+	if (run->refill != NULL && run->refill(run) && run->pos < run->end)
+		return *run->pos;
+	return INT64_MAX;
+}
+
+/**
+ * Play the matches in the subtree of @a node, store the losers.
+ * The leaves are the nodes from run_count to 2 * run_count - 1.
+ * Returns the winner.
+ */
+static int
+merge_tree_build(struct merge_tree *t, int node)
+{
+	if (node >= t->run_count)
+		return node - t->run_count;
+	int left = merge_tree_build(t, node * 2);
+	int right = merge_tree_build(t, node * 2 + 1);
+	if (t->keys[right] < t->keys[left]) {
+		t->tree[node] = left;
+		return right;
+	}
+	t->tree[node] = right;
+	return left;
+}
+
+void
+merge_tree_create(struct merge_tree *t, struct merge_run *runs,
+		  int run_count)
+{
+	t->run_count = run_count;
+	t->runs = runs;
+	t->keys = malloc(sizeof(t->keys[0]) * (run_count + 1));
+	t->tree = malloc(sizeof(t->tree[0]) * (run_count + 1));
+	if (run_count == 0) {
+		/* A fake run which is over. */
+		t->keys[0] = INT64_MAX;
+		t->tree[0] = 0;
+		return;
+	}
+	for (int i = 0; i < run_count; ++i)
+		t->keys[i] = merge_run_key(&runs[i]);
+	t->tree[0] = merge_tree_build(t, 1);
+}
+
+void
+merge_tree_destroy(struct merge_tree *t)
+{
+	free(t->keys);
+	free(t->tree);
+}
+
+size_t
+merge_tree_next(struct merge_tree *t, int *out, size_t count)
+{
+	int64_t *keys = t->keys;
+	int *tree = t->tree;
+	int run_count = t->run_count;
+	int winner = tree[0];
+	size_t i = 0;
+	for (; i < count && keys[winner] != INT64_MAX; ++i) {
+		out[i] = keys[winner];
+		struct merge_run *run = &t->runs[winner];
+		++run->pos;
+		keys[winner] = merge_run_key(run);
+		/* Replay the matches up to the root. */
+		for (int node = (winner + run_count) / 2; node > 0;
+		     node /= 2) {
+			int loser = tree[node];
+			if (keys[loser] < keys[winner]) {
+				tree[node] = winner;
+				winner = loser;
+			}
+		}
+	}
+	tree[0] = winner;
+	return i;
+}
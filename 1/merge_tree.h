@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * K-way merge of sorted int arrays via a tournament tree of losers.
+ * Each inner node keeps the run which lost the match there, the
+ * winner goes up. Taking the next number replays only the matches
+ * on the path from the winner's leaf to the root, so it costs
+ * log2(K) comparisons and no matter how many runs are there.
+ */
+
+struct merge_run;
+
+/**
+ * Get more numbers into the run, which is over. Returns false, if
+ * there are no more.
+ */
+typedef bool (*merge_run_refill_f)(struct merge_run *run);
+
+/**
+ * A sorted array to merge. It can be a buffer over a longer run,
+ * which is refilled when it is over.
+ */
+struct merge_run {
+	const int *pos;
+	const int *end;
+	/** NULL, if the run is just the array. */
+	merge_run_refill_f refill;
+	/** Context of the refill. */
+	void *refill_arg;
+};
+
+struct merge_tree {
+	int run_count;
+	struct merge_run *runs;
+	/**
+	 * Current number of each run, or INT64_MAX if the run is
+	 * over. It is wider than int, so the end is never confused
+	 * with a number.
+	 */
+	int64_t *keys;
+	/** tree[0] - the winner, tree[1..count - 1] - the losers. */
+	int *tree;
+};
+
+/** Prepare merging of the runs. They are not copied. */
+void
+merge_tree_create(struct merge_tree *t, struct merge_run *runs,
+		  int run_count);
+
+void
+merge_tree_destroy(struct merge_tree *t);
+
+/**
+ * Take not more than @a count next numbers in the ascending order
+ * into @a out. Returns how many are taken, 0 when all the runs are
+ * over.
+ */
+size_t
+merge_tree_next(struct merge_tree *t, int *out, size_t count);
@@ -0,0 +1,118 @@
+#include "radix_sort.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/** The key bits order the signed numbers as unsigned. */
+static inline uint32_t
+radix_sort_key(int v)
+{
+	return (uint32_t)v ^ 0x80000000u;
+}
+
+void
+radix_sort_create(struct radix_sort *s, int *data, int *tmp,
+		  size_t count)
+{
+	s->src = data;
+	s->dst = tmp;
+	s->count = count;
+	s->digit = -1;
+	s->pos = 0;
+	memset(s->hist, 0, sizeof(s->hist));
+}
+
+/** Count the digits of the numbers in [begin, end). */
+static void
+radix_sort_count(struct radix_sort *s, size_t begin, size_t end)
+{
+	size_t *h0 = s->hist[0], *h1 = s->hist[1];
+	size_t *h2 = s->hist[2], *h3 = s->hist[3];
+	const int *src = s->src;
+	for (size_t i = begin; i < end; ++i) {
+		uint32_t key = radix_sort_key(src[i]);
+		++h0[key & 0xff];
+		++h1[(key >> 8) & 0xff];
+		++h2[(key >> 16) & 0xff];
+		++h3[key >> 24];
+	}
+}
+
+/**
+ * Start scattering the first digit from @a digit, which differs in
+ * the numbers. Returns false, if there are none.
+ */
+static bool
+radix_sort_next_digit(struct radix_sort *s, int digit)
+{
+	for (; digit < RADIX_SORT_DIGIT_COUNT; ++digit) {
+		const size_t *hist = s->hist[digit];
+		size_t offset = 0;
+		bool is_trivial = false;
+		for (int b = 0; b < RADIX_SORT_BUCKET_COUNT; ++b) {
+			if (hist[b] == s->count) {
+				is_trivial = true;
+				break;
+			}
+			s->offset[b] = offset;
+			offset += hist[b];
+		}
+		if (! is_trivial) {
+			s->digit = digit;
+			s->pos = 0;
+			return true;
+		}
+	}
+	s->digit = RADIX_SORT_DIGIT_COUNT;
+	return false;
+}
+
+/** Scatter the numbers in [begin, end) by the current digit. */
+static void
+radix_sort_scatter(struct radix_sort *s, size_t begin, size_t end)
+{
+	int shift = s->digit * 8;
+	size_t *offset = s->offset;
+	const int *src = s->src;
+	int *dst = s->dst;
+	for (size_t i = begin; i < end; ++i) {
+		int v = src[i];
+		dst[offset[(radix_sort_key(v) >> shift) & 0xff]++] = v;
+	}
+}
+
+bool
+radix_sort_step(struct radix_sort *s, size_t step)
+{
+	while (s->digit < RADIX_SORT_DIGIT_COUNT) {
+		size_t end = s->count - s->pos > step ? s->pos + step :
+			     s->count;
+		if (s->digit < 0)
+			radix_sort_count(s, s->pos, end);
+		else
+			radix_sort_scatter(s, s->pos, end);
+		s->pos = end;
+		if (end < s->count)
+			return false;
+		if (s->digit >= 0) {
+			int *tmp = s->src;
+			s->src = s->dst;
+			s->dst = tmp;
+		}
+		if (! radix_sort_next_digit(s, s->digit + 1))
+			break;
+		/* The next pass is the next step. */
+		return false;
+	}
+	return true;
+}
+
+int *
+radix_sort(int *data, int *tmp, size_t count)
+{
+	struct radix_sort s;
+	radix_sort_create(&s, data, tmp, count);
+	while (! radix_sort_step(&s, count))
+		;
+	return radix_sort_result(&s);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * LSD radix sort of ints, a byte per pass. One pass over the data
+ * counts all 4 digits, then each digit takes a pass scattering the
+ * numbers into a second buffer. The digits which are the same in
+ * all the numbers are skipped - for small numbers the high bytes
+ * cost nothing.
+ *
+ * The sort is done in steps of a given number of elements and can
+ * be stopped after any of them, for example to yield a coroutine.
+ * Each step continues sequentially where the previous one ended,
+ * so the data stays in the cache.
+ */
+
+enum {
+	RADIX_SORT_DIGIT_COUNT = 4,
+	RADIX_SORT_BUCKET_COUNT = 256,
+	/** A good step size, small enough to yield often enough. */
+	RADIX_SORT_STEP_DEFAULT = 4096,
+};
+
+struct radix_sort {
+	/** Numbers of the current pass, and where they go. */
+	int *src;
+	int *dst;
+	size_t count;
+	/**
+	 * Digit being scattered, -1 while counting, and
+	 * RADIX_SORT_DIGIT_COUNT when done.
+	 */
+	int digit;
+	/** Position in the current pass. */
+	size_t pos;
+	/** Number count of each value of each digit. */
+	size_t hist[RADIX_SORT_DIGIT_COUNT][RADIX_SORT_BUCKET_COUNT];
+	/** Where the next number of each bucket goes in the pass. */
+	size_t offset[RADIX_SORT_BUCKET_COUNT];
+};
+
+/**
+ * Prepare sorting of @a count numbers in @a data. @a tmp is a
+ * buffer of the same size.
+ */
+void
+radix_sort_create(struct radix_sort *s, int *data, int *tmp,
+		  size_t count);
+
+/**
+ * Process about @a step more numbers. Returns true, when sorting is
+ * finished.
+ */
+bool
+radix_sort_step(struct radix_sort *s, size_t step);
+
+/**
+ * The sorted numbers, when the sort is finished. It is either the
+ * data or the buffer, depending on the number of passes.
+ */
+static inline int *
+radix_sort_result(const struct radix_sort *s)
+{
+	return s->src;
+}
+
+/** Sort at once. Returns the sorted array, data or tmp. */
+int *
+radix_sort(int *data, int *tmp, size_t count);
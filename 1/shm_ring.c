@@ -0,0 +1,162 @@
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The futexes are not private - they are shared between processes.
+ * All the shared fields are accessed with sequentially consistent
+ * atomics, so a sleeper either sees the new value before sleeping
+ * or its flag is seen by the other side, which then wakes it up.
+ */
+
+static int
+futex_wait(uint32_t *addr, uint32_t value, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static void
+futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static void *
+shm_map(size_t size)
+{
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	return mem == MAP_FAILED ? NULL : mem;
+}
+
+struct shm_doorbell *
+shm_doorbell_new(void)
+{
+	/* Anonymous memory is zeroed. */
+	return shm_map(sizeof(struct shm_doorbell));
+}
+
+void
+shm_doorbell_delete(struct shm_doorbell *bell)
+{
+	munmap(bell, sizeof(*bell));
+}
+
+struct shm_ring *
+shm_ring_new(size_t size, struct shm_doorbell *bell)
+{
+	uint32_t real_size = 4096;
+	while (real_size < size)
+		real_size *= 2;
+	struct shm_ring *r = shm_map(sizeof(*r) + real_size);
+	if (r == NULL)
+		return NULL;
+	r->doorbell = bell;
+	r->size = real_size;
+	return r;
+}
+
+void
+shm_ring_delete(struct shm_ring *r)
+{
+	munmap(r, sizeof(*r) + r->size);
+}
+
+/** Copy in or out of the ring data at @a pos, wrapping around. */
+static void
+shm_ring_copy(struct shm_ring *r, uint32_t pos, char *buf, size_t size,
+	      bool is_write)
+{
+	uint32_t offset = pos & (r->size - 1);
+	size_t first = r->size - offset;
+	if (first > size)
+		first = size;
+	if (is_write) {
+		memcpy(r->data + offset, buf, first);
+		memcpy(r->data, buf + first, size - first);
+	} else {
+		memcpy(buf, r->data + offset, first);
+		memcpy(buf + first, r->data, size - first);
+	}
+}
+
+void
+shm_ring_write(struct shm_ring *r, const void *data, size_t size)
+{
+	const char *pos = data;
+	uint32_t head = r->head;
+	while (size > 0) {
+		uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+		size_t free_size = r->size - (head - tail);
+		if (free_size == 0) {
+			__atomic_store_n(&r->is_writer_waiting, 1,
+					 __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == tail)
+				futex_wait(&r->tail, tail, NULL);
+			__atomic_store_n(&r->is_writer_waiting, 0,
+					 __ATOMIC_SEQ_CST);
+			continue;
+		}
+		size_t count = size < free_size ? size : free_size;
+		shm_ring_copy(r, head, (char *)pos, count, true);
+		head += count;
+		pos += count;
+		size -= count;
+		__atomic_store_n(&r->head, head, __ATOMIC_SEQ_CST);
+		struct shm_doorbell *bell = r->doorbell;
+		__atomic_add_fetch(&bell->seq, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&bell->is_waiting, __ATOMIC_SEQ_CST))
+			futex_wake(&bell->seq);
+	}
+}
+
+size_t
+shm_ring_count(const struct shm_ring *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) - r->tail;
+}
+
+size_t
+shm_ring_read(struct shm_ring *r, void *data, size_t size)
+{
+	size_t count = shm_ring_count(r);
+	if (count > size)
+		count = size;
+	if (count == 0)
+		return 0;
+	shm_ring_copy(r, r->tail, data, count, false);
+	__atomic_store_n(&r->tail, r->tail + count, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->is_writer_waiting, __ATOMIC_SEQ_CST))
+		futex_wake(&r->tail);
+	return count;
+}
+
+bool
+shm_ring_wait_any(struct shm_ring **rings, int count, int timeout_ms)
+{
+	if (count == 0)
+		return true;
+	struct shm_doorbell *bell = rings[0]->doorbell;
+	__atomic_store_n(&bell->is_waiting, 1, __ATOMIC_SEQ_CST);
+	uint32_t seq = __atomic_load_n(&bell->seq, __ATOMIC_SEQ_CST);
+	bool has_data = false;
+	for (int i = 0; i < count && ! has_data; ++i)
+		has_data = shm_ring_count(rings[i]) > 0;
+	bool rc = true;
+	if (! has_data) {
+		struct timespec timeout;
+		timeout.tv_sec = timeout_ms / 1000;
+		timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+		if (futex_wait(&bell->seq, seq, &timeout) != 0 &&
+		    errno == ETIMEDOUT)
+			rc = false;
+	}
+	__atomic_store_n(&bell->is_waiting, 0, __ATOMIC_SEQ_CST);
+	return rc;
+}
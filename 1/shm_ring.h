@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Byte rings in shared memory for passing data from forked writer
+ * processes to one reader. Each ring has one writer. The rings
+ * share a doorbell, so the reader can sleep until any of them gets
+ * data. Both sides sleep on futexes, and only when there is nothing
+ * to do - no spinning with sched_yield(). The wakeup syscalls are
+ * made only if the other side is sleeping or about to.
+ *
+ * The rings should be created before fork(), they are at the same
+ * address in all the processes then.
+ */
+
+/** Wakeups of the reader of several rings. */
+struct shm_doorbell {
+	/** Bumped on each write into any ring. */
+	uint32_t seq;
+	/** True, if the reader is going to sleep. */
+	uint32_t is_waiting;
+};
+
+struct shm_ring {
+	struct shm_doorbell *doorbell;
+	/** Written bytes, wraps around 2^32. */
+	uint32_t head;
+	/** Read bytes, wraps around 2^32. */
+	uint32_t tail;
+	/** True, if the writer is waiting for free space. */
+	uint32_t is_writer_waiting;
+	/** Data size, a power of 2. */
+	uint32_t size;
+	char data[];
+};
+
+/** Map a doorbell. Returns NULL on error. */
+struct shm_doorbell *
+shm_doorbell_new(void);
+
+void
+shm_doorbell_delete(struct shm_doorbell *bell);
+
+/**
+ * Map a ring of at least @a size bytes, rounded up to a power of
+ * 2. Returns NULL on error.
+ */
+struct shm_ring *
+shm_ring_new(size_t size, struct shm_doorbell *bell);
+
+void
+shm_ring_delete(struct shm_ring *r);
+
+/**
+ * Write all the bytes, sleeping while the ring is full. The reader
+ * is woken up after each part written.
+ */
+void
+shm_ring_write(struct shm_ring *r, const void *data, size_t size);
+
+/** Bytes in the ring ready to be read. */
+size_t
+shm_ring_count(const struct shm_ring *r);
+
+/**
+ * Read not more than @a size bytes without blocking. Returns how
+ * many are read. The writer is woken up, if it waits for space.
+ */
+size_t
+shm_ring_read(struct shm_ring *r, void *data, size_t size);
+
+/**
+ * Sleep until any of the rings sharing the doorbell has data, or
+ * @a timeout_ms has passed. Returns false on timeout.
+ */
+bool
+shm_ring_wait_any(struct shm_ring **rings, int count, int timeout_ms);
@@ -1,117 +1,919 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include "libcoro.h"
+#include "int_parse.h"
+#include "int_write.h"
+#include "merge_tree.h"
+#include "radix_sort.h"
+#include "shm_ring.h"
+#include "spill.h"
 
 /**
- * You can compile and run this code using the commands:
+ * Merge sort of files in coroutines. A pool of coroutines takes the
+ * files one by one, each file is parsed and sorted in steps, and
+ * after each step the coroutine yields if its time slice is over.
+ * Then main() merges the sorted files into result.txt.
  *
- * $> gcc solution.c libcoro.c
- * $> ./a.out
+ * The files are mapped into memory and parsed right from the page
+ * cache, no copying. While a coroutine parses a window of its file,
+ * the next one is read ahead by the kernel, and the parsed one is
+ * dropped. -r reads the files with read() instead.
+ *
+ * With -s the files bigger than a fair share of a coroutine are
+ * split into parts, each sorted on its own and merged with the rest.
+ * So the pool does not wait at the end for one coroutine sorting a
+ * big file. The time between the first and the last coroutine
+ * finishing is printed as the tail.
+ *
+ * With -m the numbers do not have to fit into memory. The files are
+ * read by blocks, and the coroutines cut them into runs which fit
+ * into the memory budget together. Each run is sorted and spilled
+ * into a temporary file, and then the runs are merged from disk.
+ *
+ * With -p the files are sorted by several forked processes, each
+ * running its own coroutine pool. They take the files from a shared
+ * counter and send the sorted ones back through shared memory rings,
+ * and main() receives and merges them.
+ *
+ * $> make
+ * $> ./a.out [-l target_latency_us] [-n coro_count] [-m memory_mb] [-r]
+ *	[-p proc_count] [-s] file...
  */
 
-struct my_context {
-	char *name;
-	/** ADD HERE YOUR OWN MEMBERS, SUCH AS FILE NAME, WORK TIME, ... */
+enum {
+	/** Numbers parsed or sorted between the yield checks. */
+	SORT_STEP = RADIX_SORT_STEP_DEFAULT,
+	/** Numbers taken from the merge tree at once. */
+	MERGE_BATCH = 1024,
+	/** Bytes read from a file at once in the external mode. */
+	SORT_READ_SIZE = 256 * 1024,
+	/** Longest token carried over from one read to the next one. */
+	SORT_TOKEN_MAX = 64,
+	/** Shortest run, whatever the memory budget is. */
+	SORT_RUN_MIN = 64 * 1024,
+	/** Bytes of a mapped file read ahead and dropped at once. */
+	SORT_MAP_WINDOW = 1024 * 1024,
+	/** Shared memory ring of each sorting process. */
+	SORT_RING_SIZE = 4 * 1024 * 1024,
+	/** How often to check that the sorting processes are alive. */
+	SORT_PROC_CHECK_MS = 100,
+	/** Parts per coroutine the files are split into by -s. */
+	SORT_SPLIT_FACTOR = 4,
+	/** Smallest part size in bytes. */
+	SORT_PART_MIN = 64 * 1024,
+};
+
+/** A file or its part to sort, and then its sorted numbers. */
+struct sort_file {
+	const char *name;
+	/** Bytes of the part, SIZE_MAX size - up to the file end. */
+	size_t offset;
+	size_t size;
+	int *numbers;
+	size_t count;
+};
+
+/** Files shared by the coroutine pool. */
+struct sort_pool {
+	struct sort_file *files;
+	int file_count;
+	/** The next file to take, shared by the sorting processes. */
+	int *next_file;
+	/** True, if the files are read by read() and not mapped. */
+	bool use_read;
+	/** Memory budget in bytes, 0 if the files are sorted in memory. */
+	size_t memory;
+	/** Numbers in a run of the external mode. */
+	size_t run_size;
+	/** The spilled runs of all the coroutines. */
+	struct spill_run *runs;
+	int run_count;
+	int run_capacity;
+	/** Where the sorted files go from a sorting process, or NULL. */
+	struct shm_ring *ring;
+	/** Number of the sorting process, -1 if there are none. */
+	int proc_id;
+};
+
+/** Context of a coroutine of the pool. */
+struct sort_worker {
+	struct sort_pool *pool;
+	struct coro *coro;
+	/** How many files it has sorted. */
+	int file_count;
+	/** Where its runs go in the external mode, fd is -1 if none. */
+	struct spill_file spill;
+};
+
+/** Header of a sorted file sent by a sorting process. */
+struct sort_msg {
+	/** Index of the file, -1 if the process has finished. */
+	int file;
+	/** Exit status of the finished process. */
+	int status;
+	/** Numbers following the header. */
+	size_t count;
+};
+
+/** A sorting process as seen by main(). */
+struct sort_proc {
+	pid_t pid;
+	struct shm_ring *ring;
+	/** The file being received, NULL if a header is expected. */
+	struct sort_file *file;
+	/** Bytes of the file numbers received. */
+	size_t received;
+	/** How many files are received. */
+	int file_count;
+	/** True, if the final message is received. */
+	bool is_done;
+	int status;
 };
 
-static struct my_context *
-my_context_new(const char *name)
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Read the whole file. Returns NULL on error. */
+static char *
+file_read(const char *name, size_t *size)
+{
+	int fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	char *buf = malloc(st.st_size + 1);
+	size_t done = 0;
+	while (done < (size_t)st.st_size) {
+		ssize_t rc = read(fd, buf + done, st.st_size - done);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			break;
+		done += rc;
+	}
+	close(fd);
+	*size = done;
+	return buf;
+}
+
+/**
+ * Map the whole file for reading. Returns NULL on error. An empty
+ * file can not be mapped by its size, so a page is mapped anyway -
+ * it is not touched.
+ */
+static char *
+file_map(const char *name, size_t *size)
+{
+	int fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	char *text = mmap(NULL, *size == 0 ? 1 : *size, PROT_READ,
+			  MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED)
+		return NULL;
+	madvise(text, *size, MADV_SEQUENTIAL);
+	return text;
+}
+
+static void
+file_unmap(char *text, size_t size)
+{
+	munmap(text, size == 0 ? 1 : size);
+}
+
+/**
+ * The parsing of a mapped text has reached the window at @a offset.
+ * Let the kernel read the next window ahead while the other
+ * coroutines work, and drop the pages of the parsed one.
+ */
+static void
+file_map_advance(const char *text, size_t size, size_t offset)
+{
+	char *base = (char *)text;
+	size_t ahead = offset + SORT_MAP_WINDOW;
+	if (ahead < size) {
+		size_t len = size - ahead;
+		if (len > SORT_MAP_WINDOW)
+			len = SORT_MAP_WINDOW;
+		madvise(base + ahead, len, MADV_WILLNEED);
+	}
+	if (offset >= SORT_MAP_WINDOW)
+		madvise(base + offset - SORT_MAP_WINDOW, SORT_MAP_WINDOW,
+			MADV_DONTNEED);
+}
+
+static bool
+is_space(char c)
 {
-	struct my_context *ctx = malloc(sizeof(*ctx));
-	ctx->name = strdup(name);
-	return ctx;
+	return isspace((unsigned char)c);
 }
 
+/**
+ * Find the file part in the whole file text. A number belongs to
+ * the part where its first byte is.
+ */
 static void
-my_context_delete(struct my_context *ctx)
+file_part(const struct sort_file *f, const char *text, size_t size,
+	  const char **begin, const char **end)
 {
-	free(ctx->name);
-	free(ctx);
+	const char *text_end = text + size;
+	const char *b = text + (f->offset < size ? f->offset : size);
+	const char *e = f->size < (size_t)(text_end - b) ? b + f->size :
+			text_end;
+	if (b > text && ! is_space(b[-1])) {
+		while (b < text_end && ! is_space(*b))
+			++b;
+	}
+	if (e > text && ! is_space(e[-1])) {
+		while (e < text_end && ! is_space(*e))
+			++e;
+	}
+	*begin = b;
+	*end = e > b ? e : b;
 }
 
 /**
- * A function, called from inside of coroutines recursively. Just to demonstrate
- * the example. You can split your code into multiple functions, that usually
- * helps to keep the individual code blocks simple.
+ * Parse the file part of the text into numbers, yielding in
+ * between. A mapped text is advised window by window.
  */
+static int
+file_parse(struct sort_file *f, const char *text, size_t size,
+	   bool is_mapped)
+{
+	const char *pos;
+	const char *end;
+	file_part(f, text, size, &pos, &end);
+	f->numbers = malloc(sizeof(int) * int_parse_max_count(end - pos));
+	f->count = 0;
+	size_t window = (pos - text) / SORT_MAP_WINDOW * SORT_MAP_WINDOW;
+	while (pos < end) {
+		if (is_mapped && (size_t)(pos - text) >= window) {
+			file_map_advance(text, size, window);
+			window += SORT_MAP_WINDOW;
+		}
+		size_t count = int_parse(&pos, end, f->numbers + f->count,
+					 SORT_STEP);
+		f->count += count;
+		if (count < SORT_STEP && pos < end) {
+			fprintf(stderr, "%s: not a number at offset %zu\n",
+				f->name, (size_t)(pos - text));
+			return -1;
+		}
+		coro_yield_if_quantum_expired();
+	}
+	return 0;
+}
+
+/** Sort the parsed numbers, yielding in between. */
 static void
-other_function(const char *name, int depth)
+file_sort(struct sort_file *f)
 {
-	printf("%s: entered function, depth = %d\n", name, depth);
-	coro_yield();
-	if (depth < 3)
-		other_function(name, depth + 1);
+	int *tmp = malloc(sizeof(int) * (f->count + 1));
+	struct radix_sort s;
+	radix_sort_create(&s, f->numbers, tmp, f->count);
+	while (! radix_sort_step(&s, SORT_STEP))
+		coro_yield_if_quantum_expired();
+	int *result = radix_sort_result(&s);
+	free(result == tmp ? f->numbers : tmp);
+	f->numbers = result;
+}
+
+/** Sort a run of numbers and spill it, yielding in between. */
+static int
+run_spill(struct sort_worker *worker, int *numbers, int *tmp, size_t count)
+{
+	struct radix_sort s;
+	radix_sort_create(&s, numbers, tmp, count);
+	while (! radix_sort_step(&s, SORT_STEP))
+		coro_yield_if_quantum_expired();
+	struct spill_run run;
+	if ((worker->spill.fd < 0 &&
+	     spill_file_create(&worker->spill) != 0) ||
+	    spill_file_append(&worker->spill, radix_sort_result(&s), count,
+			      &run) != 0) {
+		fprintf(stderr, "spill: %s\n", strerror(errno));
+		return -1;
+	}
+	/* Other coroutines could add their runs while this one wrote. */
+	struct sort_pool *pool = worker->pool;
+	if (pool->run_count == pool->run_capacity) {
+		pool->run_capacity = pool->run_capacity * 2 + 16;
+		size_t size = sizeof(pool->runs[0]) * pool->run_capacity;
+		pool->runs = realloc(pool->runs, size);
+	}
+	pool->runs[pool->run_count++] = run;
+	return 0;
 }
 
 /**
- * Coroutine body. This code is executed by all the coroutines. Here you
- * implement your solution, sort each individual file.
+ * External mode. Read the file by blocks and parse them into @a
+ * numbers. Each time the pool run size is gathered, the run is
+ * sorted and spilled. @a buf takes a block and a token cut by the
+ * previous block end, @a tmp is for sorting.
  */
 static int
-coroutine_func_f(void *context)
+file_spill(struct sort_worker *worker, struct sort_file *f, char *buf,
+	   int *numbers, int *tmp)
 {
-	/* IMPLEMENT SORTING OF INDIVIDUAL FILES HERE. */
+	size_t run_size = worker->pool->run_size;
+	int fd = open(f->name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", f->name, strerror(errno));
+		return -1;
+	}
+	/* Numbers gathered into the run. */
+	size_t count = 0;
+	/* Bytes in the buffer and the file offset of its start. */
+	size_t size = 0;
+	size_t offset = 0;
+	bool is_eof = false;
+	int rc = 0;
+	while (rc == 0 && ! is_eof) {
+		ssize_t n = coro_read(fd, buf + size, SORT_READ_SIZE);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "%s: %s\n", f->name, strerror(errno));
+			rc = -1;
+			break;
+		}
+		is_eof = n == 0;
+		size += n;
+		/* The last token can continue in the next block. */
+		const char *end = buf + size;
+		while (! is_eof && end > buf && ! is_space(end[-1]))
+			--end;
+		const char *pos = buf;
+		while (pos < end) {
+			size_t step = run_size - count;
+			if (step > SORT_STEP)
+				step = SORT_STEP;
+			size_t parsed = int_parse(&pos, end, numbers + count,
+						  step);
+			count += parsed;
+			if (parsed < step && pos < end) {
+				fprintf(stderr, "%s: not a number at offset "
+					"%zu\n", f->name, offset + (pos - buf));
+				rc = -1;
+				break;
+			}
+			if (count == run_size) {
+				rc = run_spill(worker, numbers, tmp, count);
+				count = 0;
+				if (rc != 0)
+					break;
+			}
+			coro_yield_if_quantum_expired();
+		}
+		size_t tail = buf + size - end;
+		if (rc == 0 && tail > SORT_TOKEN_MAX) {
+			fprintf(stderr, "%s: not a number at offset %zu\n",
+				f->name, offset + (end - buf));
+			rc = -1;
+		}
+		memmove(buf, end, tail);
+		offset += end - buf;
+		size = tail;
+	}
+	if (rc == 0 && count > 0)
+		rc = run_spill(worker, numbers, tmp, count);
+	close(fd);
+	return rc;
+}
 
-	struct coro *this = coro_this();
-	struct my_context *ctx = context;
-	char *name = ctx->name;
-	printf("Started coroutine %s\n", name);
-	printf("%s: switch count %lld\n", name, coro_switch_count(this));
-	printf("%s: yield\n", name);
-	coro_yield();
+/**
+ * Take the next file to sort, NULL if there are no more. The counter
+ * can be shared by processes.
+ */
+static struct sort_file *
+pool_take_file(struct sort_pool *pool)
+{
+	int i = __atomic_fetch_add(pool->next_file, 1, __ATOMIC_RELAXED);
+	return i < pool->file_count ? &pool->files[i] : NULL;
+}
 
-	printf("%s: switch count %lld\n", name, coro_switch_count(this));
-	printf("%s: yield\n", name);
-	coro_yield();
+/** Send the sorted file to main() and free the numbers. */
+static void
+file_send(struct sort_pool *pool, struct sort_file *f)
+{
+	struct sort_msg msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.file = f - pool->files;
+	msg.count = f->count;
+	shm_ring_write(pool->ring, &msg, sizeof(msg));
+	shm_ring_write(pool->ring, f->numbers, sizeof(int) * f->count);
+	free(f->numbers);
+	f->numbers = NULL;
+}
 
-	printf("%s: switch count %lld\n", name, coro_switch_count(this));
-	other_function(name, 1);
-	printf("%s: switch count after other function %lld\n", name,
-	       coro_switch_count(this));
+/** Coroutine body of the external mode. */
+static int
+sort_worker_spill_f(struct sort_worker *worker)
+{
+	struct sort_pool *pool = worker->pool;
+	char *buf = malloc(SORT_READ_SIZE + SORT_TOKEN_MAX);
+	int *numbers = malloc(sizeof(int) * pool->run_size);
+	int *tmp = malloc(sizeof(int) * pool->run_size);
+	int rc = 0;
+	struct sort_file *f;
+	while (rc == 0 && (f = pool_take_file(pool)) != NULL) {
+		rc = file_spill(worker, f, buf, numbers, tmp);
+		if (rc == 0)
+			++worker->file_count;
+	}
+	free(buf);
+	free(numbers);
+	free(tmp);
+	return rc;
+}
 
-	my_context_delete(ctx);
-	/* This will be returned from coro_status(). */
+/**
+ * Coroutine body. Take the files one by one while there are
+ * unsorted ones.
+ */
+static int
+sort_worker_f(void *context)
+{
+	struct sort_worker *worker = context;
+	struct sort_pool *pool = worker->pool;
+	if (pool->memory != 0)
+		return sort_worker_spill_f(worker);
+	struct sort_file *f;
+	while ((f = pool_take_file(pool)) != NULL) {
+		size_t size;
+		char *text = pool->use_read ? file_read(f->name, &size) :
+			     file_map(f->name, &size);
+		if (text == NULL) {
+			fprintf(stderr, "%s: %s\n", f->name, strerror(errno));
+			return -1;
+		}
+		int rc = file_parse(f, text, size, ! pool->use_read);
+		if (pool->use_read)
+			free(text);
+		else
+			file_unmap(text, size);
+		if (rc != 0)
+			return -1;
+		file_sort(f);
+		if (pool->ring != NULL)
+			file_send(pool, f);
+		++worker->file_count;
+	}
 	return 0;
 }
 
-int
-main(int argc, char **argv)
+/**
+ * Run the coroutine pool on the files until they are all sorted.
+ * The scheduler should be initialized.
+ */
+static int
+pool_run(struct sort_pool *pool, struct sort_worker *workers,
+	 int coro_count, long long latency)
 {
-	/* Delete these suppressions when start using the args. */
-	(void)argc;
-	(void)argv;
-	/* Initialize our coroutine global cooperative scheduler. */
-	coro_sched_init();
-	/* Start several coroutines. */
-	for (int i = 0; i < 3; ++i) {
-		/*
-		 * The coroutines can take any 'void *' interpretation of which
-		 * depends on what you want. Here as an example I give them
-		 * some names.
-		 */
-		char name[16];
-		sprintf(name, "coro_%d", i);
-		/*
-		 * I have to copy the name. Otherwise all the coroutines would
-		 * have the same name when they finally start.
-		 */
-		coro_new(coroutine_func_f, my_context_new(name));
-	}
-	/* Wait for all the coroutines to end. */
+	/* Each of N coroutines gets T / N of the target latency. */
+	coro_sched_set_quantum(latency * 1000 / coro_count);
+	for (int i = 0; i < coro_count; ++i) {
+		workers[i].pool = pool;
+		workers[i].spill.fd = -1;
+		workers[i].coro = coro_new(sort_worker_f, &workers[i]);
+	}
+	int rc = 0;
+	long long first_end = 0;
+	long long last_end = 0;
 	struct coro *c;
 	while ((c = coro_sched_wait()) != NULL) {
-		/*
-		 * Each 'wait' returns a finished coroutine with which you can
-		 * do anything you want. Like check its exit status, for
-		 * example. Don't forget to free the coroutine afterwards.
-		 */
-		printf("Finished %d\n", coro_status(c));
+		last_end = now_ns();
+		if (first_end == 0)
+			first_end = last_end;
+		int i = 0;
+		while (workers[i].coro != c)
+			++i;
+		if (pool->proc_id >= 0)
+			printf("proc %d ", pool->proc_id);
+		/* The work time does not include waiting for the turn. */
+		printf("coro %d: %d files, %.3f ms, %lld switches\n", i,
+		       workers[i].file_count, coro_run_time(c) / 1000000.0,
+		       coro_switch_count(c));
+		if (coro_status(c) != 0)
+			rc = -1;
 		coro_delete(c);
 	}
-	/* All coroutines have finished. */
+	/* Some coroutines were idle for that long. */
+	if (pool->proc_id >= 0)
+		printf("proc %d ", pool->proc_id);
+	printf("tail: %.3f ms\n", (last_end - first_end) / 1000000.0);
+	return rc;
+}
 
-	/* IMPLEMENT MERGING OF THE SORTED ARRAYS HERE. */
+/** Body of a sorting process. Returns its exit status. */
+static int
+proc_main(struct sort_pool *pool, struct sort_proc *proc, int proc_id,
+	  int coro_count, long long latency)
+{
+	pool->ring = proc->ring;
+	pool->proc_id = proc_id;
+	coro_sched_init();
+	struct sort_worker *workers = calloc(coro_count, sizeof(workers[0]));
+	int rc = pool_run(pool, workers, coro_count, latency);
+	struct sort_msg msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.file = -1;
+	msg.status = rc == 0 ? 0 : 1;
+	shm_ring_write(pool->ring, &msg, sizeof(msg));
+	free(workers);
+	coro_sched_destroy();
+	return msg.status;
+}
 
-	return 0;
+/**
+ * Take what has come from a sorting process. Returns how many bytes
+ * are taken, or -1 on a broken message.
+ */
+static ssize_t
+proc_receive(struct sort_pool *pool, struct sort_proc *proc)
+{
+	ssize_t total = 0;
+	while (! proc->is_done) {
+		if (proc->file == NULL) {
+			struct sort_msg msg;
+			if (shm_ring_count(proc->ring) < sizeof(msg))
+				break;
+			shm_ring_read(proc->ring, &msg, sizeof(msg));
+			total += sizeof(msg);
+			if (msg.file < 0) {
+				proc->is_done = true;
+				proc->status = msg.status;
+				break;
+			}
+			if (msg.file >= pool->file_count)
+				return -1;
+			proc->file = &pool->files[msg.file];
+			proc->file->count = msg.count;
+			proc->file->numbers = malloc(sizeof(int) * msg.count);
+			proc->received = 0;
+		}
+		struct sort_file *f = proc->file;
+		size_t size = sizeof(int) * f->count;
+		size_t count = shm_ring_read(proc->ring,
+					     (char *)f->numbers +
+					     proc->received,
+					     size - proc->received);
+		total += count;
+		proc->received += count;
+		if (proc->received == size) {
+			proc->file = NULL;
+			++proc->file_count;
+		} else if (count == 0) {
+			break;
+		}
+	}
+	return total;
+}
+
+/**
+ * Fork @a proc_count sorting processes and receive the sorted files
+ * from them into the pool.
+ */
+static int
+procs_run(struct sort_pool *pool, int proc_count, int coro_count,
+	  long long latency)
+{
+	struct shm_doorbell *bell = shm_doorbell_new();
+	int *next_file = mmap(NULL, sizeof(*next_file),
+			      PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (bell == NULL || next_file == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	pool->next_file = next_file;
+	struct sort_proc *procs = calloc(proc_count, sizeof(procs[0]));
+	struct shm_ring **rings = malloc(sizeof(rings[0]) * proc_count);
+	/* Or the buffered output is printed by each child again. */
+	fflush(stdout);
+	for (int i = 0; i < proc_count; ++i) {
+		procs[i].ring = shm_ring_new(SORT_RING_SIZE, bell);
+		if (procs[i].ring == NULL) {
+			perror("mmap");
+			exit(1);
+		}
+		procs[i].pid = fork();
+		if (procs[i].pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (procs[i].pid == 0) {
+			exit(proc_main(pool, &procs[i], i, coro_count,
+				       latency));
+		}
+	}
+	int rc = 0;
+	int active = proc_count;
+	while (active > 0) {
+		ssize_t total = 0;
+		int count = 0;
+		for (int i = 0; i < proc_count; ++i) {
+			struct sort_proc *proc = &procs[i];
+			if (proc->is_done)
+				continue;
+			ssize_t size = proc_receive(pool, proc);
+			if (size < 0) {
+				fprintf(stderr, "proc %d: broken message\n", i);
+				proc->is_done = true;
+				rc = -1;
+			} else if (proc->is_done) {
+				if (proc->status != 0)
+					rc = -1;
+			} else {
+				rings[count++] = proc->ring;
+			}
+			total += size > 0 ? size : 0;
+			if (proc->is_done)
+				--active;
+		}
+		if (total > 0 || shm_ring_wait_any(rings, count,
+						   SORT_PROC_CHECK_MS))
+			continue;
+		/* Nothing for long - check that nobody has died. */
+		for (int i = 0; i < proc_count; ++i) {
+			struct sort_proc *proc = &procs[i];
+			if (proc->is_done || shm_ring_count(proc->ring) > 0 ||
+			    waitpid(proc->pid, NULL, WNOHANG) != proc->pid)
+				continue;
+			fprintf(stderr, "proc %d: died\n", i);
+			proc->pid = -1;
+			proc->is_done = true;
+			--active;
+			rc = -1;
+		}
+	}
+	for (int i = 0; i < proc_count; ++i) {
+		if (procs[i].pid > 0)
+			waitpid(procs[i].pid, NULL, 0);
+		printf("proc %d: %d files received\n", i, procs[i].file_count);
+		shm_ring_delete(procs[i].ring);
+	}
+	free(rings);
+	free(procs);
+	munmap(next_file, sizeof(*next_file));
+	shm_doorbell_delete(bell);
+	return rc;
+}
+
+/** Merge the sorted files into the writer. */
+static int
+files_merge(struct sort_file *files, int file_count,
+	    struct int_writer *writer)
+{
+	struct merge_run *runs = malloc(sizeof(runs[0]) * file_count);
+	for (int i = 0; i < file_count; ++i) {
+		runs[i].pos = files[i].numbers;
+		runs[i].end = files[i].numbers + files[i].count;
+		runs[i].refill = NULL;
+	}
+	struct merge_tree tree;
+	merge_tree_create(&tree, runs, file_count);
+	int batch[MERGE_BATCH];
+	size_t count;
+	int rc = 0;
+	while (rc == 0 &&
+	       (count = merge_tree_next(&tree, batch, MERGE_BATCH)) > 0)
+		rc = int_writer_put(writer, batch, count);
+	merge_tree_destroy(&tree);
+	free(runs);
+	return rc;
+}
+
+/** Merge the sorted files or the spilled runs into the output file. */
+static int
+result_write(struct sort_pool *pool, const char *name)
+{
+	int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	struct int_writer writer;
+	int_writer_create(&writer, fd);
+	int rc;
+	if (pool->memory != 0) {
+		rc = spill_merge(pool->runs, pool->run_count, pool->memory,
+				 &writer);
+	} else {
+		rc = files_merge(pool->files, pool->file_count, &writer);
+	}
+	if (rc == 0)
+		rc = int_writer_flush(&writer);
+	int_writer_destroy(&writer);
+	if (close(fd) != 0)
+		rc = -1;
+	return rc;
+}
+
+/**
+ * Split the files bigger than a fair share of a coroutine into
+ * parts, SORT_SPLIT_FACTOR parts per coroutine on average. Returns
+ * the new array of files and parts.
+ */
+static struct sort_file *
+files_split(struct sort_file *files, int *file_count, int coro_count)
+{
+	size_t *sizes = calloc(*file_count, sizeof(sizes[0]));
+	size_t total = 0;
+	for (int i = 0; i < *file_count; ++i) {
+		struct stat st;
+		/* Can not be opened - will fail the sort later. */
+		if (stat(files[i].name, &st) == 0)
+			sizes[i] = st.st_size;
+		total += sizes[i];
+	}
+	size_t part = total / ((size_t)coro_count * SORT_SPLIT_FACTOR);
+	if (part < SORT_PART_MIN)
+		part = SORT_PART_MIN;
+	int count = 0;
+	for (int i = 0; i < *file_count; ++i)
+		count += sizes[i] > part ? (sizes[i] + part - 1) / part : 1;
+	struct sort_file *parts = calloc(count, sizeof(parts[0]));
+	struct sort_file *p = parts;
+	for (int i = 0; i < *file_count; ++i) {
+		if (sizes[i] <= part) {
+			*p++ = files[i];
+			continue;
+		}
+		for (size_t offset = 0; offset < sizes[i]; offset += part) {
+			p->name = files[i].name;
+			p->offset = offset;
+			p->size = part;
+			++p;
+		}
+	}
+	free(sizes);
+	free(files);
+	*file_count = count;
+	return parts;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-l target_latency_us] [-n coro_count] "
+		"[-m memory_mb] [-r] [-p proc_count] [-s] file...\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	long long start = now_ns();
+	long long latency = 0;
+	int coro_count = 0;
+	long long memory_mb = 0;
+	bool use_read = false;
+	int proc_count = 0;
+	bool is_split = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "l:n:m:rp:s")) != -1) {
+		switch (opt) {
+		case 'l':
+			latency = atoll(optarg);
+			break;
+		case 'n':
+			coro_count = atoi(optarg);
+			break;
+		case 'm':
+			memory_mb = atoll(optarg);
+			if (memory_mb <= 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'r':
+			use_read = true;
+			break;
+		case 'p':
+			proc_count = atoi(optarg);
+			if (proc_count <= 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			is_split = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	int file_count = argc - optind;
+	/*
+	 * The spilled runs are not sent between processes. And the
+	 * external mode reads whole files by blocks.
+	 */
+	if (file_count <= 0 || latency < 0 || coro_count < 0 ||
+	    (memory_mb != 0 && (proc_count != 0 || is_split))) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (coro_count == 0 && proc_count != 0)
+		coro_count = (file_count + proc_count - 1) / proc_count;
+	else if (coro_count == 0)
+		coro_count = file_count;
+
+	struct sort_pool pool;
+	pool.files = calloc(file_count, sizeof(pool.files[0]));
+	pool.file_count = file_count;
+	int next_file = 0;
+	pool.next_file = &next_file;
+	pool.use_read = use_read;
+	pool.memory = memory_mb * 1024 * 1024;
+	/*
+	 * Each coroutine keeps a run and the sorting buffer of the
+	 * same size, and a read block.
+	 */
+	pool.run_size = 0;
+	if (pool.memory / coro_count > SORT_READ_SIZE + SORT_TOKEN_MAX) {
+		pool.run_size = (pool.memory / coro_count - SORT_READ_SIZE -
+				 SORT_TOKEN_MAX) / (2 * sizeof(int));
+	}
+	if (pool.run_size < SORT_RUN_MIN)
+		pool.run_size = SORT_RUN_MIN;
+	pool.runs = NULL;
+	pool.run_count = 0;
+	pool.run_capacity = 0;
+	pool.ring = NULL;
+	pool.proc_id = -1;
+	for (int i = 0; i < file_count; ++i) {
+		pool.files[i].name = argv[optind + i];
+		pool.files[i].size = SIZE_MAX;
+	}
+	if (is_split) {
+		int worker_count = coro_count *
+				   (proc_count != 0 ? proc_count : 1);
+		pool.files = files_split(pool.files, &pool.file_count,
+					 worker_count);
+	}
+
+	struct sort_worker *workers = NULL;
+	int rc;
+	if (proc_count != 0) {
+		/* No threads or coroutines are created before fork(). */
+		rc = procs_run(&pool, proc_count, coro_count, latency);
+		coro_sched_init();
+	} else {
+		coro_sched_init();
+		workers = calloc(coro_count, sizeof(workers[0]));
+		rc = pool_run(&pool, workers, coro_count, latency);
+	}
+	if (rc == 0 && result_write(&pool, "result.txt") != 0) {
+		fprintf(stderr, "result.txt: %s\n", strerror(errno));
+		rc = -1;
+	}
+	if (rc == 0 && pool.memory != 0) {
+		printf("spilled: %d runs of up to %zu numbers\n",
+		       pool.run_count, pool.run_size);
+	}
+	if (rc == 0) {
+		printf("total: %.3f ms\n", (now_ns() - start) / 1000000.0);
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		printf("faults: %ld minor, %ld major, max RSS %ld MiB\n",
+		       ru.ru_minflt, ru.ru_majflt, ru.ru_maxrss / 1024);
+	}
+	for (int i = 0; i < pool.file_count; ++i)
+		free(pool.files[i].numbers);
+	free(pool.files);
+	if (workers != NULL) {
+		for (int i = 0; i < coro_count; ++i)
+			spill_file_destroy(&workers[i].spill);
+	}
+	free(pool.runs);
+	free(workers);
+	coro_sched_destroy();
+	return rc == 0 ? 0 : 1;
 }
@@ -0,0 +1,225 @@
+#include "spill.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "libcoro.h"
+#include "int_write.h"
+#include "merge_tree.h"
+
+int
+spill_file_create(struct spill_file *f)
+{
+	const char *dir = getenv("TMPDIR");
+	if (dir == NULL || *dir == 0)
+		dir = "/tmp";
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/sort-XXXXXX", dir) >=
+	    (int)sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	f->fd = mkstemp(path);
+	if (f->fd < 0)
+		return -1;
+	unlink(path);
+	/* The runs are read by big blocks - let readahead be big too. */
+	posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	f->size = 0;
+	return 0;
+}
+
+void
+spill_file_destroy(struct spill_file *f)
+{
+	if (f->fd >= 0)
+		close(f->fd);
+	f->fd = -1;
+}
+
+/** Append the bytes at the end of the file. */
+static int
+spill_file_write(struct spill_file *f, const void *data, size_t size)
+{
+	const char *pos = data;
+	while (size > 0) {
+		ssize_t rc = coro_write(f->fd, pos, size);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		pos += rc;
+		size -= rc;
+		f->size += rc;
+	}
+	return 0;
+}
+
+int
+spill_file_append(struct spill_file *f, const int *data, size_t count,
+		  struct spill_run *run)
+{
+	run->fd = f->fd;
+	run->offset = f->size;
+	run->count = count;
+	return spill_file_write(f, data, sizeof(data[0]) * count);
+}
+
+/** Buffered reader of a spilled run, refilling a merge run. */
+struct spill_reader {
+	int fd;
+	/** Where the next block is. */
+	off_t offset;
+	/** Numbers not read yet. */
+	size_t left;
+	int *buf;
+	size_t capacity;
+	/** errno of a failed read, 0 if none. */
+	int error;
+};
+
+static bool
+spill_reader_refill(struct merge_run *run)
+{
+	struct spill_reader *r = run->refill_arg;
+	if (r->left == 0)
+		return false;
+	size_t count = r->left < r->capacity ? r->left : r->capacity;
+	size_t size = sizeof(r->buf[0]) * count;
+	size_t done = 0;
+	while (done < size) {
+		ssize_t rc = pread(r->fd, (char *)r->buf + done, size - done,
+				   r->offset + done);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			/* The file is shorter than the run. */
+			r->error = rc < 0 ? errno : EIO;
+			r->left = 0;
+			return false;
+		}
+		done += rc;
+	}
+	r->offset += size;
+	r->left -= count;
+	run->pos = r->buf;
+	run->end = r->buf + count;
+	return true;
+}
+
+/**
+ * Merge the runs either into a new run appended to @a file, or as
+ * text into @a text if it is not NULL. Each reader and the output
+ * buffer get an equal part of @a memory.
+ */
+static int
+spill_merge_group(const struct spill_run *runs, int run_count,
+		  size_t memory, struct spill_file *file,
+		  struct spill_run *result, struct int_writer *text)
+{
+	size_t capacity = memory / (run_count + 1) / sizeof(int);
+	if (capacity == 0)
+		capacity = 1;
+	struct spill_reader *readers = malloc(sizeof(readers[0]) * run_count);
+	struct merge_run *merge_runs =
+		malloc(sizeof(merge_runs[0]) * run_count);
+	for (int i = 0; i < run_count; ++i) {
+		struct spill_reader *r = &readers[i];
+		r->fd = runs[i].fd;
+		r->offset = runs[i].offset;
+		r->left = runs[i].count;
+		r->buf = malloc(sizeof(r->buf[0]) * capacity);
+		r->capacity = capacity;
+		r->error = 0;
+		/* Empty, so the tree refills it right away. */
+		merge_runs[i].pos = r->buf;
+		merge_runs[i].end = r->buf;
+		merge_runs[i].refill = spill_reader_refill;
+		merge_runs[i].refill_arg = r;
+	}
+	if (text == NULL) {
+		result->fd = file->fd;
+		result->offset = file->size;
+		result->count = 0;
+	}
+	struct merge_tree tree;
+	merge_tree_create(&tree, merge_runs, run_count);
+	int *buf = malloc(sizeof(buf[0]) * capacity);
+	size_t count;
+	int rc = 0;
+	while (rc == 0 &&
+	       (count = merge_tree_next(&tree, buf, capacity)) > 0) {
+		if (text != NULL) {
+			rc = int_writer_put(text, buf, count);
+		} else {
+			rc = spill_file_write(file, buf,
+					      sizeof(buf[0]) * count);
+			result->count += count;
+		}
+	}
+	merge_tree_destroy(&tree);
+	free(buf);
+	for (int i = 0; i < run_count; ++i) {
+		if (rc == 0 && readers[i].error != 0) {
+			errno = readers[i].error;
+			rc = -1;
+		}
+		free(readers[i].buf);
+	}
+	free(merge_runs);
+	free(readers);
+	return rc;
+}
+
+int
+spill_merge(const struct spill_run *runs, int run_count, size_t memory,
+	    struct int_writer *out)
+{
+	/* One more buffer of the same size is for the output. */
+	size_t fan_in = memory / SPILL_READ_SIZE_MIN;
+	fan_in = fan_in < 3 ? 2 : fan_in - 1;
+	if (fan_in > SPILL_FAN_IN_MAX)
+		fan_in = SPILL_FAN_IN_MAX;
+	struct spill_run *pass = malloc(sizeof(pass[0]) * (run_count + 1));
+	for (int i = 0; i < run_count; ++i)
+		pass[i] = runs[i];
+	int pass_count = run_count;
+	/* The file of the last pass runs, -1 while merging the input. */
+	struct spill_file pass_file;
+	pass_file.fd = -1;
+	int rc = 0;
+	while (rc == 0 && (size_t)pass_count > fan_in) {
+		struct spill_file next_file;
+		if (spill_file_create(&next_file) != 0) {
+			rc = -1;
+			break;
+		}
+		int next_count = 0;
+		for (int i = 0; rc == 0 && i < pass_count; i += fan_in) {
+			int count = pass_count - i;
+			if ((size_t)count > fan_in)
+				count = fan_in;
+			/* The results overwrite the merged runs. */
+			rc = spill_merge_group(pass + i, count, memory,
+					       &next_file, &pass[next_count],
+					       NULL);
+			++next_count;
+		}
+		spill_file_destroy(&pass_file);
+		pass_file = next_file;
+		pass_count = next_count;
+	}
+	if (rc == 0)
+		rc = spill_merge_group(pass, pass_count, memory, NULL, NULL,
+				       out);
+	int save_errno = errno;
+	spill_file_destroy(&pass_file);
+	free(pass);
+	errno = save_errno;
+	return rc;
+}
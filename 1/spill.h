@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Sorted runs kept on disk, for sorting more numbers than fit into
+ * memory. A run is written into a temporary file as raw native ints
+ * - 4 bytes per number, nothing to parse on the way back. Then the
+ * runs are merged in passes: while there are more runs than the
+ * memory allows to read by big sequential blocks at once, groups of
+ * them are merged into longer runs. The last pass writes the text.
+ */
+
+struct int_writer;
+
+enum {
+	/** A merge reads each run by at least that many bytes. */
+	SPILL_READ_SIZE_MIN = 256 * 1024,
+	/** Maximal number of runs merged at once. */
+	SPILL_FAN_IN_MAX = 512,
+};
+
+/** Temporary file with runs appended one after another. */
+struct spill_file {
+	int fd;
+	/** Where the next run goes. */
+	off_t size;
+};
+
+/** A sorted run in a spill file. */
+struct spill_run {
+	int fd;
+	off_t offset;
+	size_t count;
+};
+
+/**
+ * Create a spill file in $TMPDIR or /tmp. It is unlinked right
+ * away, so it is gone when closed, even if the process crashes.
+ * Returns 0 on success, -1 on error with errno set.
+ */
+int
+spill_file_create(struct spill_file *f);
+
+/** Close the file. All its runs are gone. */
+void
+spill_file_destroy(struct spill_file *f);
+
+/**
+ * Append a sorted run to the file, and describe it in @a run. Is
+ * written by coro_write(), so in a coroutine only the caller waits
+ * for the disk. Returns 0 on success, -1 on error.
+ */
+int
+spill_file_append(struct spill_file *f, const int *data, size_t count,
+		  struct spill_run *run);
+
+/**
+ * Merge the runs into @a out, using about @a memory bytes for the
+ * read and write buffers. The intermediate passes write into their
+ * own spill files, which are closed when merged further. The input
+ * runs are not touched, their files are closed by the caller. Returns
+ * 0 on success, -1 on error with errno set.
+ */
+int
+spill_merge(const struct spill_run *runs, int run_count, size_t memory,
+	    struct int_writer *out);
@@ -0,0 +1,165 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Batch mode benchmark of the shell against /bin/sh. The startup
+ * cost is the time of running an empty command with -c. Then a
+ * script of many trivial pipelines is run with -f by the shell and
+ * as a file by /bin/sh, their output goes to /dev/null. The default
+ * line has /bin/true, not true, which is a builtin in /bin/sh.
+ *
+ * $> make && make bench
+ * $> ./bench_batch [-n line_count] [-l line] [-r startup_runs]
+ *	[-s other_shell]
+ */
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Run a program with stdout in /dev/null. Returns the nanoseconds
+ * it took, -1 if it could not be run or failed.
+ */
+static long long
+run(char **argv)
+{
+	long long start = now_ns();
+	pid_t pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		int fd = open("/dev/null", O_WRONLY);
+		if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0)
+			_exit(127);
+		close(fd);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	int status;
+	if (waitpid(pid, &status, 0) != pid || ! WIFEXITED(status) ||
+	    WEXITSTATUS(status) == 127)
+		return -1;
+	return now_ns() - start;
+}
+
+/** Average time of running an empty command. */
+static double
+startup_ms(char *shell, int run_count)
+{
+	char *argv[] = {shell, "-c", "", NULL};
+	long long total = 0;
+	for (int i = 0; i < run_count; ++i) {
+		long long ns = run(argv);
+		if (ns < 0)
+			return -1;
+		total += ns;
+	}
+	return total / 1e6 / run_count;
+}
+
+static int
+script_make(const char *path, const char *line, int count)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		return -1;
+	for (int i = 0; i < count; ++i)
+		fprintf(f, "%s\n", line);
+	return fclose(f);
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n line_count] [-l line] "
+		"[-r startup_runs] [-s other_shell]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	int line_count = 10000;
+	const char *line = "/bin/true | /bin/true";
+	int run_count = 100;
+	char *other = "/bin/sh";
+	int opt;
+	while ((opt = getopt(argc, argv, "n:l:r:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			line_count = atoi(optarg);
+			break;
+		case 'l':
+			line = optarg;
+			break;
+		case 'r':
+			run_count = atoi(optarg);
+			break;
+		case 's':
+			other = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (line_count <= 0 || run_count <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	char *shell = realpath("mybash", NULL);
+	if (shell == NULL) {
+		fprintf(stderr, "mybash should be built\n");
+		return 1;
+	}
+	char path[] = "/tmp/bench_batch_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	int rc = 1;
+	if (script_make(path, line, line_count) != 0) {
+		perror(path);
+		goto end;
+	}
+	printf("startup, %d runs of an empty -c command:\n", run_count);
+	char *shells[] = {shell, other};
+	const char *names[] = {"mybash", other};
+	for (int i = 0; i < 2; ++i) {
+		double ms = startup_ms(shells[i], run_count);
+		if (ms < 0) {
+			fprintf(stderr, "%s failed\n", names[i]);
+			goto end;
+		}
+		printf("  %-10s %8.3f ms\n", names[i], ms);
+	}
+	printf("%d lines of \"%s\":\n", line_count, line);
+	char *shell_argv[] = {shell, "-f", path, NULL};
+	char *other_argv[] = {other, path, NULL};
+	char **argvs[] = {shell_argv, other_argv};
+	for (int i = 0; i < 2; ++i) {
+		long long ns = run(argvs[i]);
+		if (ns < 0) {
+			fprintf(stderr, "%s failed\n", names[i]);
+			goto end;
+		}
+		printf("  %-10s %8.3f ms, %10.0f lines/s\n", names[i], ns / 1e6,
+		       line_count / (ns / 1e9));
+	}
+	rc = 0;
+end:
+	unlink(path);
+	free(shell);
+	return rc;
+}
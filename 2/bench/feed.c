@@ -0,0 +1,96 @@
+#include "../parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Parser feeding benchmark. A huge command line, like a generated
+ * argument list, is fed in small chunks the way solution.c reads
+ * stdin, and parser_pop_next() is called after each chunk. The line
+ * has plain, quoted and escaped arguments.
+ *
+ * $> make bench
+ * $> ./bench_feed [-s line_mb] [-c chunk_size]
+ */
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Make "echo arg ... \n" of about @a size bytes. */
+static char *
+make_line(size_t size, size_t *len, uint32_t *arg_count)
+{
+	static const char *args[] = {
+		" plain%u", " \"quoted %u\"", " esc\\ aped%u", " 'single %u'",
+	};
+	char *line = malloc(size + 64);
+	size_t pos = sprintf(line, "echo");
+	uint32_t count = 0;
+	while (pos < size) {
+		pos += sprintf(line + pos, args[count % 4], count);
+		++count;
+	}
+	line[pos++] = '\n';
+	*len = pos;
+	*arg_count = count;
+	return line;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t line_mb = 100;
+	uint32_t chunk = 1024;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:c:")) != -1) {
+		switch (opt) {
+		case 's':
+			line_mb = atoll(optarg);
+			break;
+		case 'c':
+			chunk = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s line_mb] "
+				"[-c chunk_size]\n", argv[0]);
+			return 1;
+		}
+	}
+	size_t len;
+	uint32_t arg_count;
+	char *str = make_line(line_mb * 1024 * 1024, &len, &arg_count);
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+	long long start = now_ns();
+	for (size_t pos = 0; pos < len; pos += chunk) {
+		uint32_t size = len - pos < chunk ? len - pos : chunk;
+		parser_feed(p, str + pos, size);
+		if (parser_pop_next(p, &line) != PARSER_ERR_NONE) {
+			fprintf(stderr, "parse error\n");
+			return 1;
+		}
+		if (line != NULL)
+			break;
+	}
+	double sec = (now_ns() - start) / 1e9;
+	if (line == NULL || line->head->cmd.arg_count != arg_count ||
+	    strcmp(line->head->cmd.args[1], "quoted 1") != 0 ||
+	    strcmp(line->head->cmd.args[2], "esc aped2") != 0) {
+		fprintf(stderr, "wrong result\n");
+		return 1;
+	}
+	printf("%.1f MB line, %u args, %u byte chunks: %.3f s, %.1f MB/s\n",
+	       len / 1048576.0, arg_count, chunk, sec, len / 1048576.0 / sec);
+	command_line_delete(line);
+	parser_delete(p);
+	free(str);
+	return 0;
+}
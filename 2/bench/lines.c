@@ -0,0 +1,208 @@
+#include "../parser.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Command line building benchmark. A script is parsed with the lines
+ * allocated piece by piece and in arenas. The heap calls are counted
+ * by wrapping malloc() and friends, and reported per line together
+ * with the parse speed. The script is a file, tests.txt by default,
+ * or a generated one of typical lines. It is fed in chunks of -c
+ * bytes, 0 means all at once, like a script read in one call.
+ *
+ * $> make bench
+ * $> ./bench_lines [-f script] [-g line_count] [-r repeat_count]
+ *	[-c chunk_size]
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static long long alloc_count;
+static long long free_count;
+
+void *
+malloc(size_t size)
+{
+	++alloc_count;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t count, size_t size)
+{
+	++alloc_count;
+	return __libc_calloc(count, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	++alloc_count;
+	return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	if (ptr != NULL)
+		++free_count;
+	__libc_free(ptr);
+}
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static char *
+read_file(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	off_t len = lseek(fd, 0, SEEK_END);
+	char *buf = malloc(len + 1);
+	if (pread(fd, buf, len, 0) != len) {
+		perror(path);
+		exit(1);
+	}
+	close(fd);
+	*size = len;
+	return buf;
+}
+
+/** A script of @a count lines like the ones people type. */
+static char *
+make_script(int count, size_t *size)
+{
+	static const char *lines[] = {
+		"ls -la /tmp | grep -v foo | wc -l > out.txt\n",
+		"echo \"hello world\" && cat 'file name' || true\n",
+		"gcc -Wall -Wextra -O2 -g main.c util.c -o main && ./main\n",
+		"cat data.txt | sort | uniq -c | sort -rn | head -n 10\n",
+		"echo 123\\ 456 >> log.txt &\n",
+		"# a comment\n",
+		"find . -name '*.c' -o -name '*.h' | xargs wc -l\n",
+		"cd ..\n",
+	};
+	int line_count = sizeof(lines) / sizeof(lines[0]);
+	size_t capacity = 0;
+	for (int i = 0; i < line_count; ++i)
+		capacity += strlen(lines[i]);
+	capacity = capacity * (count / line_count + 1);
+	char *script = malloc(capacity);
+	size_t pos = 0;
+	for (int i = 0; i < count; ++i) {
+		const char *line = lines[i % line_count];
+		size_t len = strlen(line);
+		memcpy(script + pos, line, len);
+		pos += len;
+	}
+	*size = pos;
+	return script;
+}
+
+static void
+run(const char *script, size_t size, size_t chunk_size, int repeat_count,
+    bool use_arena)
+{
+	long long lines = 0;
+	long long allocs = alloc_count;
+	long long frees = free_count;
+	long long start = now_ns();
+	for (int r = 0; r < repeat_count; ++r) {
+		struct parser *p = parser_new();
+		parser_set_arena(p, use_arena);
+		for (size_t pos = 0; pos < size; pos += chunk_size) {
+			size_t len = size - pos < chunk_size ? size - pos :
+				     chunk_size;
+			parser_feed(p, script + pos, len);
+			while (true) {
+				struct command_line *line;
+				enum parser_error err =
+					parser_pop_next(p, &line);
+				if (err == PARSER_ERR_NONE && line == NULL)
+					break;
+				++lines;
+				if (line != NULL)
+					command_line_delete(line);
+			}
+		}
+		parser_delete(p);
+	}
+	double sec = (now_ns() - start) / 1e9;
+	allocs = alloc_count - allocs;
+	frees = free_count - frees;
+	printf("  %-8s %8.2f allocs, %8.2f frees per line, "
+	       "%7.1f MB/s, %6.2f M lines/s\n", use_arena ? "arena" : "malloc",
+	       (double)allocs / lines, (double)frees / lines,
+	       size * repeat_count / sec / 1e6, lines / sec / 1e6);
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-f script] [-g line_count] "
+		"[-r repeat_count] [-c chunk_size]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *path = "tests.txt";
+	int gen_count = 0;
+	int repeat_count = 100;
+	long long chunk_size = 1024;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:g:r:c:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'g':
+			gen_count = atoi(optarg);
+			break;
+		case 'r':
+			repeat_count = atoi(optarg);
+			break;
+		case 'c':
+			chunk_size = atoll(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (repeat_count <= 0 || gen_count < 0 || chunk_size < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	size_t size;
+	char *script;
+	if (gen_count > 0) {
+		script = make_script(gen_count, &size);
+		printf("%d generated lines, %zu bytes:\n", gen_count, size);
+	} else {
+		script = read_file(path, &size);
+		printf("%s, %zu bytes:\n", path, size);
+	}
+	if (chunk_size == 0)
+		chunk_size = size;
+	run(script, size, chunk_size, repeat_count, false);
+	run(script, size, chunk_size, repeat_count, true);
+	free(script);
+	return 0;
+}
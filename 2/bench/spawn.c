@@ -0,0 +1,128 @@
+#include "../launch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Process start latency against the RSS of the starting process. The
+ * process grows its memory step by step, like a shell with big
+ * buffers, and at each size starts and waits for `true` many times
+ * with posix_spawn() and with fork() + exec. The latency of fork()
+ * grows with the page tables to copy, of posix_spawn() does not.
+ *
+ * $> make bench
+ * $> ./bench_spawn [-m 0,64,256,1024] [-n run_count]
+ */
+
+enum {
+	SIZE_MAX_COUNT = 16,
+	MB = 1024 * 1024,
+};
+
+static long long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Resident memory of the process in MiB. */
+static long
+rss_mb(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	long size = 0;
+	long resident = 0;
+	if (f == NULL)
+		return -1;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = -1;
+	fclose(f);
+	return resident < 0 ? -1 : resident * sysconf(_SC_PAGESIZE) / MB;
+}
+
+typedef pid_t (*launch_method_f)(char **argv, const struct launch_io *io);
+
+/** Average microseconds of starting and waiting for a process. */
+static double
+latency_us(launch_method_f launch, int run_count)
+{
+	char *argv[] = {"true", NULL};
+	struct launch_io io = {-1, -1, NULL, 0};
+	long long start = now_ns();
+	for (int i = 0; i < run_count; ++i) {
+		pid_t pid = launch(argv, &io);
+		int status;
+		if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+		    ! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			perror("launch");
+			exit(1);
+		}
+	}
+	return (now_ns() - start) / 1e3 / run_count;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-m rss_mb,...] [-n run_count]\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+	long sizes[SIZE_MAX_COUNT] = {0, 64, 256, 1024};
+	int size_count = 4;
+	int run_count = 200;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:n:")) != -1) {
+		char *str = optarg;
+		switch (opt) {
+		case 'm':
+			for (size_count = 0; *str != 0 &&
+			     size_count < SIZE_MAX_COUNT; ++size_count) {
+				sizes[size_count] = strtol(str, &str, 10);
+				if (*str == ',')
+					++str;
+			}
+			break;
+		case 'n':
+			run_count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (run_count <= 0 || size_count == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	printf("rss_mb,spawn_us,fork_exec_us\n");
+	long ballast = 0;
+	for (int i = 0; i < size_count; ++i) {
+		if (sizes[i] > ballast) {
+			/* Touched, so the pages are really there. */
+			size_t size = (size_t)(sizes[i] - ballast) * MB;
+			char *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mem == MAP_FAILED) {
+				perror("mmap");
+				return 1;
+			}
+			memset(mem, 1, size);
+			ballast = sizes[i];
+		}
+		double spawn = latency_us(launch_spawn, run_count);
+		double fork_exec = latency_us(launch_fork_exec, run_count);
+		printf("%ld,%.1f,%.1f\n", rss_mb(), spawn, fork_exec);
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include "launch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+pid_t
+launch_spawn(char **argv, const struct launch_io *io)
+{
+	posix_spawn_file_actions_t actions;
+	if (posix_spawn_file_actions_init(&actions) != 0)
+		return -1;
+	int rc = 0;
+	if (io->in_fd >= 0)
+		rc = posix_spawn_file_actions_adddup2(&actions, io->in_fd,
+						      STDIN_FILENO);
+	if (rc == 0 && io->out_file != NULL)
+		rc = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+						      io->out_file,
+						      io->out_flags, 0644);
+	else if (rc == 0 && io->out_fd >= 0)
+		rc = posix_spawn_file_actions_adddup2(&actions, io->out_fd,
+						      STDOUT_FILENO);
+	pid_t pid;
+	if (rc == 0)
+		rc = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (rc != 0) {
+		errno = rc;
+		return -1;
+	}
+	return pid;
+}
+
+/** Replace the standard streams in a forked child. */
+static void
+launch_redirect(const struct launch_io *io)
+{
+	if (io->in_fd >= 0 && dup2(io->in_fd, STDIN_FILENO) < 0) {
+		perror("dup2");
+		_exit(1);
+	}
+	int out_fd = io->out_fd;
+	if (io->out_file != NULL) {
+		out_fd = open(io->out_file, io->out_flags, 0644);
+		if (out_fd < 0) {
+			fprintf(stderr, "%s: %s\n", io->out_file,
+				strerror(errno));
+			_exit(1);
+		}
+	}
+	if (out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0) {
+		perror("dup2");
+		_exit(1);
+	}
+	if (io->out_file != NULL && out_fd != STDOUT_FILENO)
+		close(out_fd);
+}
+
+pid_t
+launch_fork_exec(char **argv, const struct launch_io *io)
+{
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+	launch_redirect(io);
+	execvp(argv[0], argv);
+	fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+	_exit(127);
+}
+
+pid_t
+launch_fork(launch_f func, void *arg, const struct launch_io *io)
+{
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+	launch_redirect(io);
+	_exit(func(arg));
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <sys/types.h>
+
+/**
+ * Starting of the shell's processes. Commands are started with
+ * posix_spawnp(), which in glibc is clone(CLONE_VM | CLONE_VFORK):
+ * the child shares the shell's memory until exec, so the page tables
+ * are not copied, and the start costs the same with any shell RSS.
+ * The stdin and stdout are replaced, and the output file is opened
+ * with the file actions - in the child, so the shell does not block
+ * on opening a FIFO.
+ *
+ * fork() is used only for running the shell's own code in a child -
+ * a builtin in a pipeline or a background list.
+ *
+ * All the pipe and file descriptors of the shell should be opened
+ * with O_CLOEXEC, so the commands get only the standard ones.
+ */
+
+/** Standard streams of a started process. */
+struct launch_io {
+	/** stdin, -1 keeps the shell's. */
+	int in_fd;
+	/** stdout, -1 keeps the shell's. */
+	int out_fd;
+	/** If not NULL, stdout is this file opened with out_flags. */
+	const char *out_file;
+	int out_flags;
+};
+
+/** Code run in a forked child, returns its exit status. */
+typedef int (*launch_f)(void *arg);
+
+/**
+ * Start a command found in PATH, @a argv is NULL terminated. Returns
+ * the pid, -1 on error with errno set - ENOENT if there is no such
+ * command, or the output file open error.
+ */
+pid_t
+launch_spawn(char **argv, const struct launch_io *io);
+
+/**
+ * Same as launch_spawn(), but with fork() and execvp(). The child
+ * prints the error and exits with 127, if the exec fails, or with 1,
+ * if the output file can not be opened.
+ */
+pid_t
+launch_fork_exec(char **argv, const struct launch_io *io);
+
+/**
+ * fork() a child with the given streams, which exits with the result
+ * of @a func(@a arg). Returns the pid, -1 on error.
+ */
+pid_t
+launch_fork(launch_f func, void *arg, const struct launch_io *io);
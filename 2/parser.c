@@ -2,13 +2,20 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <stdalign.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
-struct parser {
-	char *buffer;
-	uint32_t size;
-	uint32_t capacity;
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum {
+	/** The first arena chunk, enough for most of the lines. */
+	ARENA_CHUNK_SIZE = 4096,
 };
 
 enum token_type {
@@ -23,19 +30,156 @@ enum token_type {
 	TOKEN_TYPE_BACKGROUND,
 };
 
+enum token_state {
+	/** Skipping the whitespace before the token. */
+	TOKEN_STATE_SPACE,
+	TOKEN_STATE_WORD,
+	/** After a backslash outside of quotes. */
+	TOKEN_STATE_ESCAPE,
+	/** After a backslash inside double quotes. */
+	TOKEN_STATE_QUOTED_ESCAPE,
+	/** After an operator char, which can be doubled. */
+	TOKEN_STATE_OPERATOR,
+	TOKEN_STATE_COMMENT,
+};
+
+/**
+ * A token being parsed. The input can end at any byte, then the
+ * tokenizer state is kept here, and the parsing goes on from the
+ * same place when more input is fed.
+ */
 struct token {
+	/** NONE while the token is not complete. */
 	enum token_type type;
 	char *data;
 	uint32_t size;
 	uint32_t capacity;
+	enum token_state state;
+	/** The open quote, 0 if none. */
+	char quote;
+	/** The char of the OPERATOR state. */
+	char op;
+};
+
+enum parser_state {
+	/** Commands and operators between them. */
+	PARSER_STATE_EXPR,
+	/** After > or >>, the file name is expected. */
+	PARSER_STATE_OUT_FILE,
+	/** After the output file, & or the line end is expected. */
+	PARSER_STATE_AFTER_OUT,
+	/** After &, the line end is expected. */
+	PARSER_STATE_AFTER_BACKGROUND,
+	/** The line has an error, skipping it to the end. */
+	PARSER_STATE_SKIP,
 };
 
+/**
+ * The fed bytes are tokenized once. A line, which is not complete
+ * yet, is kept half built together with its last token, so a huge
+ * line fed in small chunks costs linear time.
+ */
+struct parser {
+	/**
+	 * Input. The bytes before pos are tokenized already, they are
+	 * dropped only when the space is needed, not on each line.
+	 */
+	char *buffer;
+	uint32_t pos;
+	uint32_t size;
+	uint32_t capacity;
+	/** The line being built, NULL if no tokens yet. */
+	struct command_line *line;
+	struct token token;
+	enum parser_state state;
+	/** The error to return at the end of a skipped line. */
+	enum parser_error error;
+	/** Build the lines in arenas. */
+	bool use_arena;
+};
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	char data[];
+};
+
+/**
+ * Bump allocator of one command line. Nothing is freed until the
+ * whole line is deleted. The first chunk is allocated together with
+ * the line, more chunks are added when it is full.
+ */
+struct arena {
+	char *pos;
+	char *end;
+	/** Size of the last chunk. */
+	size_t chunk_size;
+	/** The chunks after the first one, the last first. */
+	struct arena_chunk *chunks;
+};
+
+/** A line allocated together with its arena and first chunk. */
+struct arena_line {
+	struct command_line line;
+	struct arena arena;
+	char data[ARENA_CHUNK_SIZE];
+};
+
+static void *
+arena_alloc(struct arena *a, size_t size, size_t align)
+{
+	char *pos = (char *)(((uintptr_t)a->pos + align - 1) & ~(align - 1));
+	if (pos > a->end || size > (size_t)(a->end - pos)) {
+		size_t chunk_size = a->chunk_size * 2;
+		if (chunk_size < size + align)
+			chunk_size = size + align;
+		struct arena_chunk *c = malloc(sizeof(*c) + chunk_size);
+		c->next = a->chunks;
+		a->chunks = c;
+		a->chunk_size = chunk_size;
+		a->end = c->data + chunk_size;
+		pos = (char *)(((uintptr_t)c->data + align - 1) &
+			       ~(align - 1));
+	}
+	a->pos = pos + size;
+	return pos;
+}
+
+static struct command_line *
+command_line_new(bool use_arena)
+{
+	if (! use_arena)
+		return calloc(1, sizeof(struct command_line));
+	struct arena_line *l = malloc(sizeof(*l));
+	memset(&l->line, 0, sizeof(l->line));
+	l->line.arena = &l->arena;
+	l->arena.pos = l->data;
+	l->arena.end = l->data + sizeof(l->data);
+	l->arena.chunk_size = sizeof(l->data);
+	l->arena.chunks = NULL;
+	return &l->line;
+}
+
+/** Zeroed memory for a part of the line. */
+static void *
+line_calloc(struct command_line *line, size_t size)
+{
+	if (line->arena == NULL)
+		return calloc(1, size);
+	void *res = arena_alloc(line->arena, size, alignof(max_align_t));
+	memset(res, 0, size);
+	return res;
+}
+
 static char *
-token_strdup(const struct token *t)
+token_strdup(const struct token *t, struct command_line *line)
 {
 	assert(t->type == TOKEN_TYPE_STR);
 	assert(t->size > 0);
-	char *res = malloc(t->size + 1);
+	char *res;
+	if (line->arena == NULL)
+		res = malloc(t->size + 1);
+	else
+		res = arena_alloc(line->arena, t->size + 1, 1);
 	memcpy(res, t->data, t->size);
 	res[t->size] = 0;
 	return res;
@@ -53,19 +197,49 @@ token_append(struct token *t, char c)
 	t->data[t->size++] = c;
 }
 
+static void
+token_append_str(struct token *t, const char *str, uint32_t size)
+{
+	if (t->size + size > t->capacity) {
+		uint32_t capacity = (t->capacity + 1) * 2;
+		if (capacity < t->size + size)
+			capacity = t->size + size;
+		t->data = realloc(t->data, sizeof(*t->data) * capacity);
+		t->capacity = capacity;
+	}
+	memcpy(t->data + t->size, str, size);
+	t->size += size;
+}
+
 static void
 token_reset(struct token *t)
 {
 	t->size = 0;
 	t->type = TOKEN_TYPE_NONE;
+	t->state = TOKEN_STATE_SPACE;
+	t->quote = 0;
 }
 
 static void
-command_append_arg(struct command *cmd, char *arg)
+command_append_arg(struct command_line *line, struct command *cmd,
+		   char *arg)
 {
 	if (cmd->arg_count == cmd->arg_capacity) {
-		cmd->arg_capacity = (cmd->arg_capacity + 1) * 2;
-		cmd->args = realloc(cmd->args, sizeof(*cmd->args) * cmd->arg_capacity);
+		uint32_t capacity = (cmd->arg_capacity + 1) * 2;
+		size_t size = sizeof(*cmd->args) * capacity;
+		if (line->arena == NULL) {
+			cmd->args = realloc(cmd->args, size);
+		} else {
+			/* The old array stays in the arena till the end. */
+			char **args = arena_alloc(line->arena, size,
+						  alignof(char *));
+			if (cmd->arg_count > 0) {
+				memcpy(args, cmd->args,
+				       sizeof(*cmd->args) * cmd->arg_count);
+			}
+			cmd->args = args;
+		}
+		cmd->arg_capacity = capacity;
 	} else {
 		assert(cmd->arg_count < cmd->arg_capacity);
 	}
@@ -75,6 +249,17 @@ command_append_arg(struct command *cmd, char *arg)
 void
 command_line_delete(struct command_line *line)
 {
+	if (line->arena != NULL) {
+		struct arena_chunk *c = line->arena->chunks;
+		while (c != NULL) {
+			struct arena_chunk *next = c->next;
+			free(c);
+			c = next;
+		}
+		/* The line is the head of its arena_line. */
+		free(line);
+		return;
+	}
 	while (line->head != NULL) {
 		struct expr *e = line->head;
 		if (e->type == EXPR_TYPE_COMMAND) {
@@ -108,335 +293,469 @@ parser_new(void)
 }
 
 void
-parser_feed(struct parser *p, const char *str, uint32_t len)
+parser_set_arena(struct parser *p, bool is_enabled)
+{
+	p->use_arena = is_enabled;
+}
+
+char *
+parser_feed_reserve(struct parser *p, uint32_t len)
 {
-	uint32_t cap = p->capacity - p->size;
-	if (cap < len) {
-		uint32_t new_capacity = (p->capacity + 1) * 2;
-		if (new_capacity - p->size < len)
-			new_capacity = p->size + len;
-		p->buffer = realloc(p->buffer, sizeof(*p->buffer) * new_capacity);
-		p->capacity = new_capacity;
+	if (p->capacity - p->size >= len)
+		return p->buffer + p->size;
+	uint32_t used = p->size - p->pos;
+	/*
+	 * Move the rest to the front only if the dropped part is not
+	 * smaller, so each byte is moved O(1) times on average.
+	 */
+	if (p->pos > 0 && p->pos >= used) {
+		memmove(p->buffer, p->buffer + p->pos, used);
+		p->pos = 0;
+		p->size = used;
+		if (p->capacity - p->size >= len)
+			return p->buffer + p->size;
 	}
-	memcpy(p->buffer + p->size, str, len);
+	uint32_t new_capacity = (p->capacity + 1) * 2;
+	if (new_capacity - p->size < len)
+		new_capacity = p->size + len;
+	p->buffer = realloc(p->buffer, sizeof(*p->buffer) * new_capacity);
+	p->capacity = new_capacity;
+	return p->buffer + p->size;
+}
+
+void
+parser_feed_commit(struct parser *p, uint32_t len)
+{
+	assert(p->capacity - p->size >= len);
 	p->size += len;
-	assert(p->size <= p->capacity);
 }
 
-static void
-parser_consume(struct parser *p, uint32_t size)
+void
+parser_feed(struct parser *p, const char *str, uint32_t len)
 {
-	assert(p->size >= size);
-	if (size == p->size) {
-		p->size = 0;
-		return;
+	memcpy(parser_feed_reserve(p, len), str, len);
+	parser_feed_commit(p, len);
+}
+
+/** Complete an operator token, return the bytes used. */
+static uint32_t
+parse_operator(struct token *out, char c)
+{
+	bool is_double = c == out->op;
+	switch (out->op) {
+	case '&':
+		out->type = is_double ? TOKEN_TYPE_AND : TOKEN_TYPE_BACKGROUND;
+		break;
+	case '|':
+		out->type = is_double ? TOKEN_TYPE_OR : TOKEN_TYPE_PIPE;
+		break;
+	case '>':
+		out->type = is_double ? TOKEN_TYPE_OUT_APPEND :
+			    TOKEN_TYPE_OUT_NEW;
+		break;
+	default:
+		assert(false);
+		break;
+	}
+	return is_double ? 1 : 0;
+}
+
+/** Chars, which are not just copied into a word out of quotes. */
+static const bool word_special_chars[256] = {
+	[' '] = true, ['\t'] = true, ['\r'] = true, ['\n'] = true,
+	['\''] = true, ['"'] = true, ['\\'] = true, ['&'] = true,
+	['|'] = true, ['>'] = true, ['#'] = true,
+};
+
+static inline bool
+word_char_is_special(char c, char quote)
+{
+	if (quote == 0)
+		return word_special_chars[(unsigned char)c];
+	return c == quote || (quote == '"' && c == '\\');
+}
+
+#if defined(__AVX2__)
+#define WORD_VEC_SIZE 32
+#define word_vec_t __m256i
+#define word_vec_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define word_vec_eq(v, c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define word_vec_or(a, b) _mm256_or_si256(a, b)
+#define word_vec_mask(v) (uint32_t)_mm256_movemask_epi8(v)
+#elif defined(__SSE2__)
+#define WORD_VEC_SIZE 16
+#define word_vec_t __m128i
+#define word_vec_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define word_vec_eq(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define word_vec_or(a, b) _mm_or_si128(a, b)
+#define word_vec_mask(v) (uint32_t)_mm_movemask_epi8(v)
+#endif
+
+#ifdef WORD_VEC_SIZE
+
+/** Bit mask of the special chars of WORD_VEC_SIZE bytes at @a pos. */
+static inline uint32_t
+word_vec_special(const char *pos, char quote)
+{
+	word_vec_t v = word_vec_load(pos);
+	word_vec_t m = word_vec_eq(v, quote != 0 ? quote : '\'');
+	if (quote == '\'')
+		return word_vec_mask(m);
+	m = word_vec_or(m, word_vec_eq(v, '\\'));
+	if (quote == '"')
+		return word_vec_mask(m);
+	m = word_vec_or(m, word_vec_eq(v, '"'));
+	m = word_vec_or(m, word_vec_eq(v, ' '));
+	m = word_vec_or(m, word_vec_eq(v, '\t'));
+	m = word_vec_or(m, word_vec_eq(v, '\r'));
+	m = word_vec_or(m, word_vec_eq(v, '\n'));
+	m = word_vec_or(m, word_vec_eq(v, '&'));
+	m = word_vec_or(m, word_vec_eq(v, '|'));
+	m = word_vec_or(m, word_vec_eq(v, '>'));
+	m = word_vec_or(m, word_vec_eq(v, '#'));
+	return word_vec_mask(m);
+}
+
+#endif
+
+/**
+ * Find the first char in [pos, end), which is special inside a word
+ * with the given open quote. The plain chars before it can be copied
+ * into the token as is. With SSE2 or AVX2 the chars are checked 16
+ * or 32 at once.
+ */
+static const char *
+word_scan(const char *pos, const char *end, char quote)
+{
+#ifdef WORD_VEC_SIZE
+	for (; end - pos >= WORD_VEC_SIZE; pos += WORD_VEC_SIZE) {
+		uint32_t mask = word_vec_special(pos, quote);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
 	}
-	memmove(p->buffer, p->buffer + size, p->size - size);
-	p->size -= size;
+#endif
+	while (pos < end && ! word_char_is_special(*pos, quote))
+		++pos;
+	return pos;
 }
 
+/**
+ * Continue parsing the token from @a pos. Returns how many bytes
+ * are used. If the token is complete, its type is set. Otherwise
+ * all the bytes are used, and the state is saved in the token.
+ */
 static uint32_t
 parse_token(const char *pos, const char *end, struct token *out)
 {
-	token_reset(out);
 	const char *begin = pos;
+	const char *plain_end;
 	while (pos < end) {
-		if (!isspace(*pos))
+		char c = *pos;
+		switch (out->state) {
+		case TOKEN_STATE_SPACE:
+			if (c == '\n') {
+				out->type = TOKEN_TYPE_NEW_LINE;
+				return pos + 1 - begin;
+			}
+			if (isspace(c)) {
+				++pos;
+				continue;
+			}
+			out->state = TOKEN_STATE_WORD;
+			continue;
+		case TOKEN_STATE_ESCAPE:
+			++pos;
+			out->state = TOKEN_STATE_WORD;
+			/* Escaped new line is a line continuation. */
+			if (c != '\n')
+				token_append(out, c);
+			continue;
+		case TOKEN_STATE_QUOTED_ESCAPE:
+			++pos;
+			out->state = TOKEN_STATE_WORD;
+			if (c == '\n')
+				continue;
+			if (c != '\\' && c != '"')
+				token_append(out, '\\');
+			token_append(out, c);
+			continue;
+		case TOKEN_STATE_OPERATOR:
+			pos += parse_operator(out, c);
+			return pos - begin;
+		case TOKEN_STATE_COMMENT:
+			++pos;
+			if (c == '\n') {
+				out->type = TOKEN_TYPE_NEW_LINE;
+				return pos - begin;
+			}
+			continue;
+		case TOKEN_STATE_WORD:
 			break;
-		if (*pos == '\n') {
-			out->type = TOKEN_TYPE_NEW_LINE;
-			return pos + 1 - begin;
 		}
-		++pos;
-	}
-	char quote = 0;
-	while (pos < end) {
-		char c = *pos;
-		switch(c) {
+		switch (c) {
 		case '\'':
 		case '"':
-			if (quote == 0) {
-				quote = c;
+			if (out->quote == 0) {
+				out->quote = c;
 				++pos;
-				if (pos == end)
-					return 0;
 				continue;
 			}
-			if (quote != c)
+			if (out->quote != c)
 				goto append_and_next;
 			out->type = TOKEN_TYPE_STR;
 			return pos + 1 - begin;
 		case '\\':
-			if (quote == '\'')
+			if (out->quote == '\'')
 				goto append_and_next;
-			if (quote == '"') {
-				++pos;
-				if (pos == end)
-					return 0;
-				c = *pos;
-				switch (c)
-				{
-				case '\\':
-					goto append_and_next;
-				case '\n':
-					++pos;
-					continue;
-				case '"':
-					goto append_and_next;
-				default:
-					break;
-				}
-				token_append(out, '\\');
-				goto append_and_next;
-			}
-			assert(quote == 0);
+			out->state = out->quote == '"' ?
+				     TOKEN_STATE_QUOTED_ESCAPE :
+				     TOKEN_STATE_ESCAPE;
 			++pos;
-			if (pos == end)
-				return 0;
-			c = *pos;
-			if (c == '\n') {
-				++pos;
-				continue;
-			}
-			goto append_and_next;
+			continue;
 		case '&':
 		case '|':
 		case '>':
-			if (quote != 0)
+			if (out->quote != 0)
 				goto append_and_next;
 			if (out->size > 0) {
 				out->type = TOKEN_TYPE_STR;
 				return pos - begin;
 			}
+			out->state = TOKEN_STATE_OPERATOR;
+			out->op = c;
 			++pos;
-			if (pos == end)
-				return 0;
-			if (*pos == c) {
-				switch(c) {
-				case '&':
-					out->type = TOKEN_TYPE_AND;
-					break;
-				case '|':
-					out->type = TOKEN_TYPE_OR;
-					break;
-				case '>':
-					out->type = TOKEN_TYPE_OUT_APPEND;
-					break;
-				default:
-					assert(false);
-					break;
-				}
-				++pos;
-			} else {
-				switch(c) {
-				case '&':
-					out->type = TOKEN_TYPE_BACKGROUND;
-					break;
-				case '|':
-					out->type = TOKEN_TYPE_PIPE;
-					break;
-				case '>':
-					out->type = TOKEN_TYPE_OUT_NEW;
-					break;
-				default:
-					assert(false);
-					break;
-				}
-			}
-			return pos - begin;
+			continue;
 		case ' ':
 		case '\t':
 		case '\r':
-			if (quote != 0)
-				goto append_and_next;
-			assert(out->size > 0);
-			out->type = TOKEN_TYPE_STR;
-			return pos + 1 - begin;
 		case '\n':
-			if (quote != 0)
+			if (out->quote != 0)
 				goto append_and_next;
-			assert(out->size > 0);
+			if (out->size == 0) {
+				/* Only a line continuation was before. */
+				out->state = TOKEN_STATE_SPACE;
+				continue;
+			}
 			out->type = TOKEN_TYPE_STR;
-			return pos - begin;
+			return pos + (c != '\n') - begin;
 		case '#':
-			if (quote != 0)
+			if (out->quote != 0)
 				goto append_and_next;
 			if (out->size > 0) {
 				out->type = TOKEN_TYPE_STR;
 				return pos - begin;
 			}
+			out->state = TOKEN_STATE_COMMENT;
 			++pos;
-			while (pos < end) {
-				if (*pos == '\n') {
-					out->type = TOKEN_TYPE_NEW_LINE;
-					return pos + 1 - begin;
-				}
-				++pos;
-			}
-			return 0;
+			continue;
 		default:
 			goto append_and_next;
 		}
 	append_and_next:
-		token_append(out, c);
-		++pos;
+		/* The char itself and the plain run after it. */
+		plain_end = word_scan(pos + 1, end, out->quote);
+		token_append_str(out, pos, plain_end - pos);
+		pos = plain_end;
 	}
-	return 0;
+	return pos - begin;
 }
 
-enum parser_error
-parser_pop_next(struct parser *p, struct command_line **out)
+/** Start the next line from scratch. */
+static void
+parser_reset_line(struct parser *p)
 {
-	struct command_line *line = calloc(1, sizeof(*line));
-	char *pos = p->buffer;
-	const char *begin = pos;
-	char *end = pos + p->size;
-	struct token token = {0};
-	enum parser_error res = PARSER_ERR_NONE;
+	if (p->line != NULL)
+		command_line_delete(p->line);
+	p->line = NULL;
+	p->state = PARSER_STATE_EXPR;
+	p->error = PARSER_ERR_NONE;
+}
 
-	while (pos < end) {
-		uint32_t used = parse_token(pos, end, &token);
-		if (used == 0)
-			goto return_no_line;
-		pos += used;
-		struct expr *e;
-		switch(token.type) {
-		case TOKEN_TYPE_STR:
-			if (line->tail != NULL && line->tail->type == EXPR_TYPE_COMMAND) {
-				command_append_arg(&line->tail->cmd, token_strdup(&token));
-				continue;
-			}
-			e = calloc(1, sizeof(*e));
-			e->type = EXPR_TYPE_COMMAND;
-			e->cmd.exe = token_strdup(&token);
-			command_line_append(line, e);
-			continue;
-		case TOKEN_TYPE_NEW_LINE:
-			/* Skip new lines. */
-			if (line->tail == NULL)
-				continue;
-			goto close_and_return;
-		case TOKEN_TYPE_PIPE:
-			if (line->tail == NULL) {
-				res = PARSER_ERR_PIPE_WITH_NO_LEFT_ARG;
-				goto return_error;
-			}
-			if (line->tail->type != EXPR_TYPE_COMMAND) {
-				res = PARSER_ERR_PIPE_WITH_LEFT_ARG_NOT_A_COMMAND;
-				goto return_error;
-			}
-			e = calloc(1, sizeof(*e));
-			e->type = EXPR_TYPE_PIPE;
-			command_line_append(line, e);
-			continue;
-		case TOKEN_TYPE_AND:
-			if (line->tail == NULL) {
-				res = PARSER_ERR_AND_WITH_NO_LEFT_ARG;
-				goto return_error;
-			}
-			if (line->tail->type != EXPR_TYPE_COMMAND) {
-				res = PARSER_ERR_AND_WITH_LEFT_ARG_NOT_A_COMMAND;
-				goto return_error;
-			}
-			e = calloc(1, sizeof(*e));
-			e->type = EXPR_TYPE_AND;
-			command_line_append(line, e);
-			continue;
-		case TOKEN_TYPE_OR:
-			if (line->tail == NULL) {
-				res = PARSER_ERR_OR_WITH_NO_LEFT_ARG;
-				goto return_error;
-			}
-			if (line->tail->type != EXPR_TYPE_COMMAND) {
-				res = PARSER_ERR_OR_WITH_LEFT_ARG_NOT_A_COMMAND;
-				goto return_error;
-			}
-			e = calloc(1, sizeof(*e));
-			e->type = EXPR_TYPE_OR;
-			command_line_append(line, e);
-			continue;
-		case TOKEN_TYPE_OUT_NEW:
-		case TOKEN_TYPE_OUT_APPEND:
-		case TOKEN_TYPE_BACKGROUND:
-			goto close_and_return;
-		default:
-			assert(false);
+/** Skip the rest of the line and return @a error at its end. */
+static void
+parser_skip_line(struct parser *p, enum parser_error error)
+{
+	p->state = PARSER_STATE_SKIP;
+	p->error = error;
+}
+
+/** Check that an operator has a command on the left. */
+static enum parser_error
+parser_check_operator(struct command_line *line, enum parser_error no_arg,
+		      enum parser_error not_a_command)
+{
+	if (line->tail == NULL)
+		return no_arg;
+	if (line->tail->type != EXPR_TYPE_COMMAND)
+		return not_a_command;
+	return PARSER_ERR_NONE;
+}
+
+/**
+ * Apply a complete token to the line. Returns true, if the line is
+ * over - either complete, or has an error in p->error.
+ */
+static bool
+parser_apply_token(struct parser *p, struct token *token)
+{
+	struct command_line *line = p->line;
+	enum parser_error err = PARSER_ERR_NONE;
+	enum expr_type type;
+	struct expr *e;
+	switch (p->state) {
+	case PARSER_STATE_EXPR:
+		break;
+	case PARSER_STATE_OUT_FILE:
+		if (token->type != TOKEN_TYPE_STR) {
+			parser_skip_line(p, PARSER_ERR_OUTOUT_REDIRECT_BAD_ARG);
+			return token->type == TOKEN_TYPE_NEW_LINE;
 		}
+		line->out_file = token_strdup(token, line);
+		p->state = PARSER_STATE_AFTER_OUT;
+		return false;
+	case PARSER_STATE_AFTER_OUT:
+		if (token->type == TOKEN_TYPE_BACKGROUND) {
+			line->is_background = true;
+			p->state = PARSER_STATE_AFTER_BACKGROUND;
+			return false;
+		}
+		/* Fallthrough. */
+	case PARSER_STATE_AFTER_BACKGROUND:
+		if (token->type == TOKEN_TYPE_NEW_LINE)
+			goto line_end;
+		parser_skip_line(p, PARSER_ERR_TOO_LATE_ARGUMENTS);
+		return false;
+	case PARSER_STATE_SKIP:
+		return token->type == TOKEN_TYPE_NEW_LINE;
 	}
-	goto return_no_line;
-
-close_and_return:
-	if (token.type == TOKEN_TYPE_OUT_NEW || token.type == TOKEN_TYPE_OUT_APPEND)
-	{
-		if (token.type == TOKEN_TYPE_OUT_NEW)
+	switch (token->type) {
+	case TOKEN_TYPE_STR:
+		if (line->tail != NULL &&
+		    line->tail->type == EXPR_TYPE_COMMAND) {
+			command_append_arg(line, &line->tail->cmd,
+					   token_strdup(token, line));
+			return false;
+		}
+		e = line_calloc(line, sizeof(*e));
+		e->type = EXPR_TYPE_COMMAND;
+		e->cmd.exe = token_strdup(token, line);
+		command_line_append(line, e);
+		return false;
+	case TOKEN_TYPE_NEW_LINE:
+		/* Skip empty lines. */
+		if (line->tail == NULL)
+			return false;
+		goto line_end;
+	case TOKEN_TYPE_PIPE:
+		err = parser_check_operator(line,
+			PARSER_ERR_PIPE_WITH_NO_LEFT_ARG,
+			PARSER_ERR_PIPE_WITH_LEFT_ARG_NOT_A_COMMAND);
+		type = EXPR_TYPE_PIPE;
+		break;
+	case TOKEN_TYPE_AND:
+		err = parser_check_operator(line,
+			PARSER_ERR_AND_WITH_NO_LEFT_ARG,
+			PARSER_ERR_AND_WITH_LEFT_ARG_NOT_A_COMMAND);
+		type = EXPR_TYPE_AND;
+		break;
+	case TOKEN_TYPE_OR:
+		err = parser_check_operator(line,
+			PARSER_ERR_OR_WITH_NO_LEFT_ARG,
+			PARSER_ERR_OR_WITH_LEFT_ARG_NOT_A_COMMAND);
+		type = EXPR_TYPE_OR;
+		break;
+	case TOKEN_TYPE_OUT_NEW:
+	case TOKEN_TYPE_OUT_APPEND:
+		if (token->type == TOKEN_TYPE_OUT_NEW)
 			line->out_type = OUTPUT_TYPE_FILE_NEW;
 		else
 			line->out_type = OUTPUT_TYPE_FILE_APPEND;
-		uint32_t used = parse_token(pos, end, &token);
-		if (used == 0)
-			goto return_no_line;
-		pos += used;
-		if (token.type != TOKEN_TYPE_STR) {
-			res = PARSER_ERR_OUTOUT_REDIRECT_BAD_ARG;
-			goto return_error;
-		}
-		line->out_file = token_strdup(&token);
-		used = parse_token(pos, end, &token);
-		if (used == 0)
-			goto return_no_line;
-		pos += used;
-	}
-	if (token.type == TOKEN_TYPE_BACKGROUND) {
+		p->state = PARSER_STATE_OUT_FILE;
+		return false;
+	case TOKEN_TYPE_BACKGROUND:
 		line->is_background = true;
-		uint32_t used = parse_token(pos, end, &token);
-		if (used == 0)
-			goto return_no_line;
-		pos += used;
+		p->state = PARSER_STATE_AFTER_BACKGROUND;
+		return false;
+	default:
+		assert(false);
+		return false;
 	}
-	if (token.type == TOKEN_TYPE_NEW_LINE) {
-		assert(line->tail != NULL);
-		parser_consume(p, pos - begin);
-		if (line->tail->type != EXPR_TYPE_COMMAND) {
-			res = PARSER_ERR_ENDS_NOT_WITH_A_COMMAND;
-			goto return_no_line;
-		}
-		res = PARSER_ERR_NONE;
-		*out = line;
-		goto return_final;
+	if (err != PARSER_ERR_NONE) {
+		parser_skip_line(p, err);
+		return false;
 	}
-	res = PARSER_ERR_TOO_LATE_ARGUMENTS;
-	goto return_error;
+	e = line_calloc(line, sizeof(*e));
+	e->type = type;
+	command_line_append(line, e);
+	return false;
 
-return_error:
-	/*
-	 * Try to skip the whole current line. It can't be executed but can't
-	 * just crash here because of that.
-	 */
-	while (pos < end) {
-		uint32_t used = parse_token(pos, end, &token);
-		if (used == 0)
+line_end:
+	if (line->tail == NULL || line->tail->type != EXPR_TYPE_COMMAND)
+		p->error = PARSER_ERR_ENDS_NOT_WITH_A_COMMAND;
+	return true;
+}
+
+/**
+ * Parse till the end of a line or of the input at @a *pos. The used
+ * bytes are in the token and the line then, @a *pos is moved past
+ * them.
+ */
+static enum parser_error
+parser_parse(struct parser *p, const char **pos, const char *end,
+	     struct command_line **out)
+{
+	*out = NULL;
+	struct token *token = &p->token;
+	enum parser_error res = PARSER_ERR_NONE;
+	while (*pos < end) {
+		*pos += parse_token(*pos, end, token);
+		if (token->type == TOKEN_TYPE_NONE)
 			break;
-		pos += used;
-		if (token.type == TOKEN_TYPE_NEW_LINE) {
-			parser_consume(p, pos - begin);
-			goto return_no_line;
+		if (p->line == NULL)
+			p->line = command_line_new(p->use_arena);
+		bool is_line_end = parser_apply_token(p, token);
+		token_reset(token);
+		if (!is_line_end)
+			continue;
+		res = p->error;
+		if (res == PARSER_ERR_NONE) {
+			*out = p->line;
+			p->line = NULL;
 		}
+		parser_reset_line(p);
+		break;
 	}
-	res = PARSER_ERR_NONE;
-	goto return_no_line;
-
-return_no_line:
-	command_line_delete(line);
-	*out = NULL;
+	return res;
+}
 
-return_final:
-	free(token.data);
+enum parser_error
+parser_pop_next(struct parser *p, struct command_line **out)
+{
+	const char *pos = p->buffer + p->pos;
+	enum parser_error res = parser_parse(p, &pos, p->buffer + p->size,
+					     out);
+	p->pos = pos - p->buffer;
+	if (p->pos == p->size) {
+		p->pos = 0;
+		p->size = 0;
+	}
 	return res;
 }
 
+enum parser_error
+parser_pop_from(struct parser *p, const char **str, const char *end,
+		struct command_line **out)
+{
+	assert(p->pos == p->size);
+	return parser_parse(p, str, end, out);
+}
+
 void
 parser_delete(struct parser *p)
 {
+	if (p->line != NULL)
+		command_line_delete(p->line);
+	free(p->token.data);
 	free(p->buffer);
 	free(p);
 }
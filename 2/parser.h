@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 struct parser;
+struct arena;
 
 enum parser_error {
 	PARSER_ERR_NONE,
@@ -52,19 +53,58 @@ struct command_line {
 	/** Valid if the out type is FILE. */
 	char *out_file;
 	bool is_background;
+	/**
+	 * Memory of all the line's exprs, args and strings. NULL, if
+	 * they are allocated one by one.
+	 */
+	struct arena *arena;
 };
 
+/**
+ * Free the line. If it has an arena, that is a few free() calls,
+ * regardless of the line size.
+ */
 void
 command_line_delete(struct command_line *line);
 
 struct parser *
 parser_new(void);
 
+/**
+ * Build the next lines each in its own arena - in one allocation
+ * usually. Off by default.
+ */
+void
+parser_set_arena(struct parser *p, bool is_enabled);
+
 void
 parser_feed(struct parser *p, const char *str, uint32_t len);
 
+/**
+ * Get at least @a len bytes of free space at the input end, so the
+ * input can be read right into the parser. The bytes are added with
+ * parser_feed_commit(). The space is valid till the next call on
+ * the parser.
+ */
+char *
+parser_feed_reserve(struct parser *p, uint32_t len);
+
+/** Add @a len bytes written into the reserved space to the input. */
+void
+parser_feed_commit(struct parser *p, uint32_t len);
+
 enum parser_error
 parser_pop_next(struct parser *p, struct command_line **out);
 
+/**
+ * Same as parser_pop_next(), but the input is taken right from the
+ * caller's memory [@a *str, @a end), without feeding it. @a *str is
+ * moved past the used bytes, the memory of which can be dropped
+ * then. The fed input should be all popped before.
+ */
+enum parser_error
+parser_pop_from(struct parser *p, const char **str, const char *end,
+		struct command_line **out);
+
 void
 parser_delete(struct parser *p);
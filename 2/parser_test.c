@@ -2,6 +2,7 @@
 
 #include "unit.h"
 
+#include <stdio.h>
 #include <string.h>
 
 static void
@@ -819,6 +820,295 @@ test_errors(void)
 	unit_test_finish();
 }
 
+static void
+test_long_line(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	/*
+	 * The line is fed in odd chunks, so they end inside quotes,
+	 * escapes, operators and comments.
+	 */
+	const char *part = "a\\ b \"c\\\"d\" 'e\\' f\\\n \\\n";
+	const uint32_t part_count = 1000;
+	uint32_t part_len = strlen(part);
+	char chunk[7];
+	for (uint32_t i = 0, pos = 0; i < part_count * part_len;) {
+		uint32_t size = 0;
+		for (; size < sizeof(chunk) && i < part_count * part_len; ++i)
+			chunk[size++] = part[pos++ % part_len];
+		parser_feed(p, chunk, size);
+		unit_fail_if(parser_pop_next(p, &line) != PARSER_ERR_NONE);
+		unit_fail_if(line != NULL);
+	}
+	const char *str = "x >> out.txt # comment & | >";
+	uint32_t len = strlen(str);
+	for (uint32_t i = 0; i < len; i += 2) {
+		parser_feed(p, &str[i], i + 1 < len ? 2 : 1);
+		unit_fail_if(parser_pop_next(p, &line) != PARSER_ERR_NONE);
+		unit_fail_if(line != NULL);
+	}
+	parser_feed(p, "\n", 1);
+	unit_fail_if(parser_pop_next(p, &line) != PARSER_ERR_NONE);
+	unit_check(line != NULL, "parse");
+	unit_check(line->out_type == OUTPUT_TYPE_FILE_APPEND, "out type");
+	unit_check(strcmp(line->out_file, "out.txt") == 0, "out file");
+	struct expr *e = line->head;
+	unit_check(e->type == EXPR_TYPE_COMMAND, "expr type");
+	unit_check(strcmp(e->cmd.exe, "a b") == 0, "exe");
+	unit_check(e->cmd.arg_count == part_count * 4, "arg count");
+	bool is_ok = true;
+	for (uint32_t i = 0; i < part_count && is_ok; ++i) {
+		char **args = &e->cmd.args[i * 4];
+		is_ok = strcmp(args[0], "c\"d") == 0 &&
+			strcmp(args[1], "e\\") == 0 &&
+			strcmp(args[2], "f") == 0 &&
+			strcmp(args[3], i + 1 < part_count ? "a b" : "x") == 0;
+	}
+	unit_check(is_ok, "args");
+	unit_check(e->next == NULL, "no more exprs");
+	command_line_delete(line);
+
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse none");
+	unit_check(line == NULL, "no line");
+	parser_delete(p);
+	unit_test_finish();
+}
+
+static void
+test_arena(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	parser_set_arena(p, true);
+	struct command_line *line = NULL;
+
+	const char *str = "echo 'a b' c | grep -v d >> \"out file\" &\n";
+	parser_feed(p, str, strlen(str));
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_check(line->arena != NULL, "has arena");
+	unit_check(line->out_type == OUTPUT_TYPE_FILE_APPEND, "out type");
+	unit_check(strcmp(line->out_file, "out file") == 0, "out file");
+	unit_check(line->is_background, "is background");
+	struct expr *e = line->head;
+	unit_check(strcmp(e->cmd.exe, "echo") == 0, "exe");
+	unit_check(e->cmd.arg_count == 2, "arg count");
+	unit_check(strcmp(e->cmd.args[0], "a b") == 0, "arg[0]");
+	unit_check(strcmp(e->cmd.args[1], "c") == 0, "arg[1]");
+	e = e->next;
+	unit_check(e->type == EXPR_TYPE_PIPE, "expr type");
+	e = e->next;
+	unit_check(strcmp(e->cmd.exe, "grep") == 0, "exe");
+	unit_check(e->cmd.arg_count == 2, "arg count");
+	unit_check(e->next == NULL, "no more exprs");
+	command_line_delete(line);
+
+	unit_msg("Line bigger than an arena chunk");
+	const uint32_t arg_count = 10000;
+	parser_feed(p, "echo", 4);
+	for (uint32_t i = 0; i < arg_count; ++i) {
+		char arg[32];
+		int len = snprintf(arg, sizeof(arg), " arg%u", i);
+		parser_feed(p, arg, len);
+	}
+	parser_feed(p, " && ls\n", 7);
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	e = line->head;
+	unit_check(e->cmd.arg_count == arg_count, "arg count");
+	bool is_ok = true;
+	for (uint32_t i = 0; i < arg_count && is_ok; ++i) {
+		char arg[32];
+		snprintf(arg, sizeof(arg), "arg%u", i);
+		is_ok = strcmp(e->cmd.args[i], arg) == 0;
+	}
+	unit_check(is_ok, "args");
+	unit_check(e->next->type == EXPR_TYPE_AND, "expr type");
+	unit_check(strcmp(e->next->next->cmd.exe, "ls") == 0, "exe");
+	command_line_delete(line);
+
+	unit_msg("Bad line in an arena");
+	parser_feed(p, "ls | | ls\n", 10);
+	unit_check(parser_pop_next(p, &line) ==
+		   PARSER_ERR_PIPE_WITH_LEFT_ARG_NOT_A_COMMAND, "parse error");
+	unit_check(line == NULL, "no line");
+
+	unit_msg("Partial line is freed with the parser");
+	parser_feed(p, "echo 123 |", 10);
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_check(line == NULL, "no line yet");
+	parser_delete(p);
+	unit_test_finish();
+}
+
+static char *
+str_repeat(char *pos, char c, uint32_t count)
+{
+	memset(pos, c, count);
+	return pos + count;
+}
+
+static void
+test_long_words(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	/*
+	 * Runs of plain chars of all lengths around the vector sizes,
+	 * so the special chars fall at each position of a vector.
+	 */
+	const uint32_t len_max = 70;
+	char str[16 * len_max];
+	char expected[4][4 * len_max];
+	bool is_ok = true;
+	for (uint32_t len = 1; len <= len_max && is_ok; ++len) {
+		/* A'B'C\ D "E\"F" G|H */
+		char *pos = str_repeat(str, 'A', len);
+		*pos++ = '\'';
+		pos = str_repeat(pos, 'B', len);
+		*pos++ = '\'';
+		pos = str_repeat(pos, 'C', len);
+		*pos++ = '\\';
+		*pos++ = ' ';
+		pos = str_repeat(pos, 'D', len);
+		*pos++ = ' ';
+		*pos++ = '"';
+		pos = str_repeat(pos, 'E', len);
+		*pos++ = '\\';
+		*pos++ = '"';
+		pos = str_repeat(pos, 'F', len);
+		*pos++ = '"';
+		*pos++ = ' ';
+		pos = str_repeat(pos, 'G', len);
+		*pos++ = '|';
+		pos = str_repeat(pos, 'H', len);
+		*pos++ = '\n';
+		parser_feed(p, str, pos - str);
+
+		pos = str_repeat(expected[0], 'A', len);
+		*str_repeat(pos, 'B', len) = 0;
+		pos = str_repeat(expected[1], 'C', len);
+		*pos++ = ' ';
+		*str_repeat(pos, 'D', len) = 0;
+		pos = str_repeat(expected[2], 'E', len);
+		*pos++ = '"';
+		*str_repeat(pos, 'F', len) = 0;
+		*str_repeat(expected[3], 'G', len) = 0;
+
+		is_ok = parser_pop_next(p, &line) == PARSER_ERR_NONE &&
+			line != NULL;
+		if (! is_ok)
+			break;
+		struct expr *e = line->head;
+		struct expr *pipe = e->next;
+		is_ok = strcmp(e->cmd.exe, expected[0]) == 0 &&
+			e->cmd.arg_count == 3 &&
+			strcmp(e->cmd.args[0], expected[1]) == 0 &&
+			strcmp(e->cmd.args[1], expected[2]) == 0 &&
+			strcmp(e->cmd.args[2], expected[3]) == 0 &&
+			pipe->type == EXPR_TYPE_PIPE &&
+			strlen(pipe->next->cmd.exe) == len &&
+			pipe->next->cmd.exe[len - 1] == 'H';
+		command_line_delete(line);
+	}
+	unit_check(is_ok, "all lengths");
+
+	parser_delete(p);
+	unit_test_finish();
+}
+
+static void
+test_feed_reserve(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	/*
+	 * Many lines in one feed, popped one by one, and the next feeds
+	 * reuse the space of the popped ones.
+	 */
+	const uint32_t line_count = 1000;
+	bool is_ok = true;
+	for (uint32_t round = 0; round < 3 && is_ok; ++round) {
+		char *buf = parser_feed_reserve(p, line_count * 16);
+		uint32_t size = 0;
+		/* The end of the previous round's last line. */
+		if (round > 0)
+			size += sprintf(buf, " tail\n");
+		for (uint32_t i = 0; i < line_count; ++i)
+			size += sprintf(buf + size, "echo %u\n", i);
+		size += sprintf(buf + size, "echo");
+		parser_feed_commit(p, size);
+		for (uint32_t i = round > 0 ? 0 : 1; i <= line_count && is_ok;
+		     ++i) {
+			char arg[16];
+			if (i == 0)
+				sprintf(arg, "tail");
+			else
+				sprintf(arg, "%u", i - 1);
+			is_ok = parser_pop_next(p, &line) == PARSER_ERR_NONE &&
+				line != NULL &&
+				strcmp(line->head->cmd.exe, "echo") == 0 &&
+				line->head->cmd.arg_count == 1 &&
+				strcmp(line->head->cmd.args[0], arg) == 0;
+			if (line != NULL)
+				command_line_delete(line);
+		}
+		is_ok = is_ok &&
+			parser_pop_next(p, &line) == PARSER_ERR_NONE &&
+			line == NULL;
+	}
+	unit_check(is_ok, "lines of several feeds");
+
+	parser_feed(p, " 123\n", 5);
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_check(strcmp(line->head->cmd.exe, "echo") == 0, "exe");
+	unit_check(strcmp(line->head->cmd.args[0], "123") == 0, "arg[0]");
+	command_line_delete(line);
+
+	parser_delete(p);
+	unit_test_finish();
+}
+
+static void
+test_pop_from(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	const char *str = "ls -l\n\necho 'a b' | cat";
+	const char *pos = str;
+	const char *end = str + strlen(str);
+	unit_check(parser_pop_from(p, &pos, end, &line) == PARSER_ERR_NONE,
+		   "parse");
+	unit_check(strcmp(line->head->cmd.exe, "ls") == 0, "exe");
+	unit_check(pos == str + 6, "used till the line end");
+	command_line_delete(line);
+
+	unit_check(parser_pop_from(p, &pos, end, &line) == PARSER_ERR_NONE,
+		   "parse");
+	unit_check(line == NULL, "no line yet");
+	unit_check(pos == end, "all used");
+
+	unit_msg("The line end is fed");
+	parser_feed(p, "\n", 1);
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	struct expr *e = line->head;
+	unit_check(strcmp(e->cmd.exe, "echo") == 0, "exe");
+	unit_check(strcmp(e->cmd.args[0], "a b") == 0, "arg[0]");
+	unit_check(e->next->type == EXPR_TYPE_PIPE, "expr type");
+	unit_check(strcmp(e->next->next->cmd.exe, "cat") == 0, "exe");
+	command_line_delete(line);
+
+	parser_delete(p);
+	unit_test_finish();
+}
+
 int
 main(void)
 {
@@ -834,5 +1124,10 @@ main(void)
 	test_logical_operators();
 	test_background();
 	test_errors();
+	test_long_line();
+	test_arena();
+	test_long_words();
+	test_feed_reserve();
+	test_pop_from();
 	return 0;
 }
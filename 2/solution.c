@@ -1,71 +1,413 @@
+#include "launch.h"
 #include "parser.h"
 
-#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+/**
+ * The shell. Each line is a list of pipelines joined with && and ||,
+ * optionally with the output redirected into a file and run in the
+ * background. The commands are started with posix_spawn() - see
+ * launch.h - and the shell forks only to run its own code in a child:
+ * a builtin inside a pipeline, or a background line with more than
+ * one pipeline, a builtin or a redirect.
+ *
+ * $> make
+ * $> ./mybash [-f script | -c command]
+ */
+
+struct shell {
+	struct parser *parser;
+	/** Exit status of the last pipeline. */
+	int status;
+	/** True, if exit was called, and no more lines are run. */
+	bool is_exit;
+};
+
+static bool
+command_is_builtin(const struct command *cmd)
+{
+	return strcmp(cmd->exe, "cd") == 0 || strcmp(cmd->exe, "exit") == 0;
+}
+
+/** Run a builtin, return its exit status. */
+static int
+builtin_run(const struct command *cmd)
+{
+	if (strcmp(cmd->exe, "exit") == 0)
+		return cmd->arg_count > 0 ? atoi(cmd->args[0]) & 0xff : 0;
+	const char *dir = cmd->arg_count > 0 ? cmd->args[0] : getenv("HOME");
+	if (dir == NULL) {
+		fprintf(stderr, "cd: HOME not set\n");
+		return 1;
+	}
+	if (chdir(dir) != 0) {
+		fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/** launch_f of a builtin in a pipeline. */
+static int
+builtin_f(void *arg)
+{
+	return builtin_run(arg);
+}
+
+/** Exit status of a finished child as the shell reports it. */
+static int
+status_from_wait(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return 1;
+}
+
+/** NULL terminated argv of a command. */
+static char **
+command_argv(const struct command *cmd)
+{
+	char **argv = malloc(sizeof(*argv) * (cmd->arg_count + 2));
+	argv[0] = cmd->exe;
+	for (uint32_t i = 0; i < cmd->arg_count; ++i)
+		argv[i + 1] = cmd->args[i];
+	argv[cmd->arg_count + 1] = NULL;
+	return argv;
+}
+
+/** A pipe, which is not inherited by the commands. */
+static int
+pipe_cloexec(int fds[2])
+{
+	if (pipe(fds) != 0)
+		return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+
+/** open() flags of the output file of a line. */
+static int
+line_out_flags(const struct command_line *line)
+{
+	int flags = O_WRONLY | O_CREAT;
+	if (line->out_type == OUTPUT_TYPE_FILE_APPEND)
+		return flags | O_APPEND;
+	return flags | O_TRUNC;
+}
+
+/** Start a pipeline stage. Returns the pid, -1 on error. */
+static pid_t
+stage_start(const struct command *cmd, const struct launch_io *io)
+{
+	if (command_is_builtin(cmd))
+		return launch_fork(builtin_f, (void *)cmd, io);
+	char **argv = command_argv(cmd);
+	pid_t pid = launch_spawn(argv, io);
+	free(argv);
+	if (pid < 0 && errno == ENOENT && io->out_file == NULL)
+		fprintf(stderr, "%s: command not found\n", cmd->exe);
+	else if (pid < 0)
+		fprintf(stderr, "%s: %s\n", cmd->exe, strerror(errno));
+	return pid;
+}
+
+/**
+ * Run a pipeline of @a count commands starting at @a e. The output of
+ * the last one goes into the file of @a out_line, if it is not NULL.
+ * Without waiting the status is 0, the children are reaped later.
+ */
 static void
-execute_command_line(const struct command_line *line)
-{
-	/* REPLACE THIS CODE WITH ACTUAL COMMAND EXECUTION */
-
-	assert(line != NULL);
-	printf("================================\n");
-	printf("Command line:\n");
-	printf("Is background: %d\n", (int)line->is_background);
-	printf("Output: ");
-	if (line->out_type == OUTPUT_TYPE_STDOUT) {
-		printf("stdout\n");
-	} else if (line->out_type == OUTPUT_TYPE_FILE_NEW) {
-		printf("new file - \"%s\"\n", line->out_file);
-	} else if (line->out_type == OUTPUT_TYPE_FILE_APPEND) {
-		printf("append file - \"%s\"\n", line->out_file);
-	} else {
-		assert(false);
+execute_pipeline(struct shell *sh, const struct expr *e, int count,
+		 const struct command_line *out_line, bool is_wait)
+{
+	if (count == 1 && command_is_builtin(&e->cmd)) {
+		/* Alone a builtin runs in the shell itself. */
+		const struct command *cmd = &e->cmd;
+		if (out_line != NULL) {
+			/* The output is empty, but the file is created. */
+			int fd = open(out_line->out_file,
+				      line_out_flags(out_line), 0644);
+			if (fd >= 0)
+				close(fd);
+		}
+		if (strcmp(cmd->exe, "exit") != 0) {
+			sh->status = builtin_run(cmd);
+			return;
+		}
+		sh->is_exit = true;
+		if (cmd->arg_count > 0)
+			sh->status = builtin_run(cmd);
+		return;
+	}
+	pid_t *pids = malloc(sizeof(*pids) * count);
+	int in_fd = -1;
+	int i = 0;
+	for (; i < count; e = e->next) {
+		if (e->type != EXPR_TYPE_COMMAND)
+			continue;
+		int fds[2] = {-1, -1};
+		if (i < count - 1 && pipe_cloexec(fds) != 0) {
+			perror("pipe");
+			break;
+		}
+		struct launch_io io = {in_fd, fds[1], NULL, 0};
+		if (i == count - 1 && out_line != NULL) {
+			io.out_file = out_line->out_file;
+			io.out_flags = line_out_flags(out_line);
+		}
+		pids[i++] = stage_start(&e->cmd, &io);
+		if (in_fd >= 0)
+			close(in_fd);
+		if (fds[1] >= 0)
+			close(fds[1]);
+		in_fd = fds[0];
+	}
+	if (in_fd >= 0)
+		close(in_fd);
+	/* A failed last stage is like a command not found. */
+	int status = i == count && pids[count - 1] >= 0 ? 0 : 127;
+	for (int j = 0; j < i && is_wait; ++j) {
+		int child_status;
+		if (pids[j] < 0 || waitpid(pids[j], &child_status, 0) < 0)
+			continue;
+		if (j == count - 1)
+			status = status_from_wait(child_status);
 	}
-	printf("Expressions:\n");
+	free(pids);
+	sh->status = status;
+}
+
+/**
+ * Run the pipelines of a line. Each next one runs, if the status is
+ * 0 after && or not 0 after ||, both have the same priority.
+ */
+static void
+execute_list(struct shell *sh, const struct command_line *line,
+	     bool is_wait)
+{
 	const struct expr *e = line->head;
+	bool is_run = true;
 	while (e != NULL) {
-		if (e->type == EXPR_TYPE_COMMAND) {
-			printf("\tCommand: %s", e->cmd.exe);
-			for (uint32_t i = 0; i < e->cmd.arg_count; ++i)
-				printf(" %s", e->cmd.args[i]);
-			printf("\n");
-		} else if (e->type == EXPR_TYPE_PIPE) {
-			printf("\tPIPE\n");
-		} else if (e->type == EXPR_TYPE_AND) {
-			printf("\tAND\n");
-		} else if (e->type == EXPR_TYPE_OR) {
-			printf("\tOR\n");
-		} else {
-			assert(false);
+		/* The pipeline goes till && or ||. */
+		const struct expr *end = e;
+		int count = 0;
+		for (; end != NULL && (end->type == EXPR_TYPE_COMMAND ||
+				       end->type == EXPR_TYPE_PIPE);
+		     end = end->next) {
+			if (end->type == EXPR_TYPE_COMMAND)
+				++count;
+		}
+		if (is_run) {
+			/* The redirect is of the last pipeline. */
+			const struct command_line *out_line = NULL;
+			if (end == NULL && line->out_type != OUTPUT_TYPE_STDOUT)
+				out_line = line;
+			execute_pipeline(sh, e, count, out_line, is_wait);
 		}
-		e = e->next;
+		if (end == NULL || sh->is_exit)
+			return;
+		if (end->type == EXPR_TYPE_AND)
+			is_run = sh->status == 0;
+		else
+			is_run = sh->status != 0;
+		e = end->next;
 	}
 }
 
-int
-main(void)
+/** A background line run in a forked shell. */
+struct subshell {
+	struct shell sh;
+	const struct command_line *line;
+};
+
+static int
+subshell_f(void *arg)
+{
+	struct subshell *sub = arg;
+	execute_list(&sub->sh, sub->line, true);
+	return sub->sh.status;
+}
+
+static void
+execute_command_line(struct shell *sh, const struct command_line *line)
+{
+	/* Reap the finished background children. */
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+	if (! line->is_background) {
+		execute_list(sh, line, true);
+		return;
+	}
+	/*
+	 * posix_spawn() returns only after the child has opened the
+	 * output file, which for a FIFO waits for a reader. So a line
+	 * with a redirect runs in a subshell too.
+	 */
+	bool is_simple = line->out_type == OUTPUT_TYPE_STDOUT;
+	for (const struct expr *e = line->head; e != NULL; e = e->next) {
+		if ((e->type == EXPR_TYPE_COMMAND &&
+		     command_is_builtin(&e->cmd)) ||
+		    e->type == EXPR_TYPE_AND || e->type == EXPR_TYPE_OR)
+			is_simple = false;
+	}
+	if (is_simple) {
+		/* One pipeline is just not waited for. */
+		execute_list(sh, line, false);
+	} else {
+		struct subshell sub = {*sh, line};
+		struct launch_io io = {-1, -1, NULL, 0};
+		if (launch_fork(subshell_f, &sub, &io) < 0)
+			perror("fork");
+	}
+	sh->status = 0;
+}
+
+static void
+execute_result(struct shell *sh, enum parser_error err,
+	       struct command_line *line)
+{
+	if (err != PARSER_ERR_NONE) {
+		fprintf(stderr, "Error: %d\n", (int)err);
+		sh->status = 2;
+		return;
+	}
+	execute_command_line(sh, line);
+	command_line_delete(line);
+}
+
+/** Execute all the complete lines fed into the parser. */
+static void
+execute_fed(struct shell *sh)
+{
+	while (! sh->is_exit) {
+		struct command_line *line;
+		enum parser_error err = parser_pop_next(sh->parser, &line);
+		if (err == PARSER_ERR_NONE && line == NULL)
+			return;
+		execute_result(sh, err, line);
+	}
+}
+
+/** Execute the lines in memory. They are parsed in place. */
+static void
+execute_str(struct shell *sh, const char *str, size_t len)
+{
+	const char *end = str + len;
+	while (! sh->is_exit) {
+		struct command_line *line;
+		enum parser_error err = parser_pop_from(sh->parser, &str, end,
+							&line);
+		if (err == PARSER_ERR_NONE && line == NULL)
+			break;
+		execute_result(sh, err, line);
+	}
+	/* The last line can have no new line at the end. */
+	parser_feed(sh->parser, "\n", 1);
+	execute_fed(sh);
+}
+
+/** Execute the lines read from @a fd till its end. */
+static void
+execute_fd(struct shell *sh, int fd)
 {
 	const size_t buf_size = 1024;
-	char buf[buf_size];
 	int rc;
-	struct parser *p = parser_new();
-	while ((rc = read(STDIN_FILENO, buf, buf_size)) > 0) {
-		parser_feed(p, buf, rc);
-		struct command_line *line = NULL;
-		while (true) {
-			enum parser_error err = parser_pop_next(p, &line);
-			if (err == PARSER_ERR_NONE && line == NULL)
-				break;
-			if (err != PARSER_ERR_NONE) {
-				printf("Error: %d\n", (int)err);
-				continue;
-			}
-			execute_command_line(line);
-			command_line_delete(line);
+	/* The input is read right into the parser, not copied. */
+	while (! sh->is_exit &&
+	       (rc = read(fd, parser_feed_reserve(sh->parser, buf_size),
+			  buf_size)) > 0) {
+		parser_feed_commit(sh->parser, rc);
+		execute_fed(sh);
+	}
+	/* Like in a script, the last line can have no new line. */
+	parser_feed(sh->parser, "\n", 1);
+	execute_fed(sh);
+}
+
+/**
+ * Execute a script file. A regular file is mapped and parsed in one
+ * pass right from the mapping, others are read.
+ */
+static int
+execute_file(struct shell *sh, const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	if (! S_ISREG(st.st_mode)) {
+		execute_fd(sh, fd);
+		close(fd);
+		return 0;
+	}
+	size_t size = st.st_size;
+	char *map = NULL;
+	if (size > 0) {
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			perror(path);
+			close(fd);
+			return -1;
 		}
+		madvise(map, size, MADV_SEQUENTIAL);
 	}
-	parser_delete(p);
+	close(fd);
+	execute_str(sh, map, size);
+	if (map != NULL)
+		munmap(map, size);
 	return 0;
 }
+
+int
+main(int argc, char **argv)
+{
+	const char *script = NULL;
+	const char *command = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:c:")) != -1) {
+		switch (opt) {
+		case 'f':
+			script = optarg;
+			break;
+		case 'c':
+			command = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f script | -c command]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	struct shell sh;
+	sh.parser = parser_new();
+	sh.status = 0;
+	sh.is_exit = false;
+	parser_set_arena(sh.parser, true);
+	int rc = 0;
+	if (command != NULL)
+		execute_str(&sh, command, strlen(command));
+	else if (script != NULL)
+		rc = execute_file(&sh, script);
+	else
+		execute_fd(&sh, STDIN_FILENO);
+	parser_delete(sh.parser);
+	return rc == 0 ? sh.status : 1;
+}